@@ -0,0 +1,351 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include "bimap.h"
+
+namespace {
+using int_bimap = bimap<int, int>;
+
+constexpr size_t lookups = 1024;
+
+// The baselines: one map per direction, kept in sync like the two sides of
+// a bimap
+template <template <typename...> typename Map>
+struct map_pair {
+  bool insert(int left, int right) {
+    if (left_.count(left) != 0 || right_.count(right) != 0) {
+      return false;
+    }
+    left_.emplace(left, right);
+    right_.emplace(right, left);
+    return true;
+  }
+
+  size_t size() const {
+    return left_.size();
+  }
+
+  Map<int, int> left_;
+  Map<int, int> right_;
+};
+
+using ordered_pair = map_pair<std::map>;
+using unordered_pair = map_pair<std::unordered_map>;
+
+// The same operations on a bimap and on a pair of maps
+bool insert(int_bimap& b, int left, int right) {
+  return b.insert(left, right) != b.end_left();
+}
+template <typename Pair>
+bool insert(Pair& p, int left, int right) {
+  return p.insert(left, right);
+}
+
+bool contains_left(int_bimap const& b, int key) {
+  return b.find_left(key) != b.end_left();
+}
+template <typename Pair>
+bool contains_left(Pair const& p, int key) {
+  return p.left_.find(key) != p.left_.end();
+}
+
+bool contains_right(int_bimap const& b, int key) {
+  return b.find_right(key) != b.end_right();
+}
+template <typename Pair>
+bool contains_right(Pair const& p, int key) {
+  return p.right_.find(key) != p.right_.end();
+}
+
+int64_t sum_lefts(int_bimap const& b) {
+  return std::accumulate(b.begin_left(), b.end_left(), int64_t(0));
+}
+template <typename Pair>
+int64_t sum_lefts(Pair const& p) {
+  int64_t res = 0;
+  for (auto const& [left, right] : p.left_) {
+    res += left;
+  }
+  return res;
+}
+
+// walks the left side and moves to the other side at every pair
+int64_t sum_flipped(int_bimap const& b) {
+  int64_t res = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    res += *it.flip();
+  }
+  return res;
+}
+template <typename Pair>
+int64_t sum_flipped(Pair const& p) {
+  int64_t res = 0;
+  for (auto const& [left, right] : p.left_) {
+    res += p.right_.find(right)->first;
+  }
+  return res;
+}
+
+// Distinct even lefts and rights in random order, so that odd keys miss
+struct dataset {
+  std::vector<int> lefts_;
+  std::vector<int> rights_;
+};
+
+dataset const& random_pairs(size_t size) {
+  static dataset cached;
+  if (cached.lefts_.size() != size) {
+    std::mt19937 e(42);
+    for (auto* keys : {&cached.lefts_, &cached.rights_}) {
+      keys->resize(size);
+      for (size_t i = 0; i < size; i++) {
+        (*keys)[i] = static_cast<int>(2 * i);
+      }
+      std::shuffle(keys->begin(), keys->end(), e);
+    }
+  }
+  return cached;
+}
+
+template <typename C>
+void fill(C& c, std::vector<int> const& lefts, std::vector<int> const& rights) {
+  for (size_t i = 0; i < lefts.size(); i++) {
+    insert(c, lefts[i], rights[i]);
+  }
+}
+
+// Building a big container takes longer than measuring it, so the last one
+// built is kept for the next benchmark of the same type and size (main
+// registers those one after another). Only one is kept at a time, the
+// biggest take gigabytes.
+template <typename C>
+C const& filled(size_t size) {
+  static std::shared_ptr<void> cached;
+  static std::type_index type = typeid(void);
+  static size_t cached_size = 0;
+  if (cached == nullptr || type != typeid(C) || cached_size != size) {
+    cached.reset();
+    auto c = std::make_shared<C>();
+    dataset const& data = random_pairs(size);
+    fill(*c, data.lefts_, data.rights_);
+    cached = c;
+    type = typeid(C);
+    cached_size = size;
+  }
+  return *static_cast<C const*>(cached.get());
+}
+
+// present keys of one side (or absent ones, one past them) in random order
+std::vector<int> random_keys(std::vector<int> const& keys, size_t count,
+                             bool hit) {
+  std::mt19937 e(7);
+  std::vector<int> res;
+  res.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    res.push_back(keys[e() % keys.size()] + (hit ? 0 : 1));
+  }
+  return res;
+}
+
+enum class order { random, sorted, reversed };
+
+// Inserting size pairs into an empty container, its destruction is not
+// measured
+template <typename C, order Order>
+void insert_pairs(benchmark::State& state) {
+  size_t size = state.range(0);
+  std::vector<int> lefts;
+  std::vector<int> rights;
+  if constexpr (Order == order::random) {
+    lefts = random_pairs(size).lefts_;
+    rights = random_pairs(size).rights_;
+  } else {
+    lefts.resize(size);
+    std::iota(lefts.begin(), lefts.end(), 0);
+    if constexpr (Order == order::reversed) {
+      std::reverse(lefts.begin(), lefts.end());
+    }
+    rights = lefts;
+  }
+  for (auto _ : state) {
+    auto c = std::make_unique<C>();
+    fill(*c, lefts, rights);
+    benchmark::DoNotOptimize(c.get());
+    state.PauseTiming();
+    c.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+
+template <typename C, bool Left, bool Hit>
+void find_keys(benchmark::State& state) {
+  C const& c = filled<C>(state.range(0));
+  dataset const& data = random_pairs(state.range(0));
+  std::vector<int> keys =
+      random_keys(Left ? data.lefts_ : data.rights_, lookups, Hit);
+  for (auto _ : state) {
+    size_t found = 0;
+    for (int key : keys) {
+      found += Left ? contains_left(c, key) : contains_right(c, key);
+    }
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetItemsProcessed(state.iterations() * lookups);
+}
+
+template <typename C>
+void insert_random(benchmark::State& state) {
+  insert_pairs<C, order::random>(state);
+}
+template <typename C>
+void insert_sorted(benchmark::State& state) {
+  insert_pairs<C, order::sorted>(state);
+}
+template <typename C>
+void insert_reversed(benchmark::State& state) {
+  insert_pairs<C, order::reversed>(state);
+}
+
+template <typename C>
+void find_left_hit(benchmark::State& state) {
+  find_keys<C, true, true>(state);
+}
+template <typename C>
+void find_left_miss(benchmark::State& state) {
+  find_keys<C, true, false>(state);
+}
+template <typename C>
+void find_right_hit(benchmark::State& state) {
+  find_keys<C, false, true>(state);
+}
+template <typename C>
+void find_right_miss(benchmark::State& state) {
+  find_keys<C, false, false>(state);
+}
+
+template <typename C>
+void iterate(benchmark::State& state) {
+  C const& c = filled<C>(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sum_lefts(c));
+  }
+  state.SetItemsProcessed(state.iterations() * c.size());
+}
+
+template <typename C>
+void flip(benchmark::State& state) {
+  C const& c = filled<C>(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sum_flipped(c));
+  }
+  state.SetItemsProcessed(state.iterations() * c.size());
+}
+
+template <typename C>
+void copy(benchmark::State& state) {
+  C const& c = filled<C>(state.range(0));
+  for (auto _ : state) {
+    auto copied = std::make_unique<C>(c);
+    benchmark::DoNotOptimize(copied.get());
+    state.PauseTiming();
+    copied.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * c.size());
+}
+
+template <typename C>
+void teardown(benchmark::State& state) {
+  size_t size = state.range(0);
+  dataset const& data = random_pairs(size);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto c = std::make_unique<C>();
+    fill(*c, data.lefts_, data.rights_);
+    state.ResumeTiming();
+    c.reset();
+  }
+  state.SetItemsProcessed(state.iterations() * size);
+}
+
+void find_left_loop(benchmark::State& state) {
+  int_bimap const& b = filled<int_bimap>(state.range(0));
+  std::vector<int> keys =
+      random_keys(random_pairs(state.range(0)).lefts_, lookups, true);
+  std::vector<int_bimap::left_iterator> found(lookups);
+  for (auto _ : state) {
+    for (size_t i = 0; i < lookups; i++) {
+      found[i] = b.find_left(keys[i]);
+    }
+    benchmark::DoNotOptimize(found.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * lookups);
+}
+
+void find_left_batch(benchmark::State& state) {
+  int_bimap const& b = filled<int_bimap>(state.range(0));
+  std::vector<int> keys =
+      random_keys(random_pairs(state.range(0)).lefts_, lookups, true);
+  std::vector<int_bimap::left_iterator> found(lookups);
+  for (auto _ : state) {
+    b.find_left_batch(keys, found);
+    benchmark::DoNotOptimize(found.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * lookups);
+}
+
+// Every benchmark of one type at one size, named like BENCHMARK_TEMPLATE
+// would name it
+template <typename C>
+void register_benchmarks(char const* type, int64_t size) {
+  auto add = [&](char const* name, void (*run)(benchmark::State&)) {
+    std::string full = std::string(name) + "<" + type + ">";
+    benchmark::RegisterBenchmark(full.c_str(), run)->Arg(size);
+  };
+  add("insert_random", insert_random<C>);
+  add("insert_sorted", insert_sorted<C>);
+  add("insert_reversed", insert_reversed<C>);
+  add("find_left_hit", find_left_hit<C>);
+  add("find_left_miss", find_left_miss<C>);
+  add("find_right_hit", find_right_hit<C>);
+  add("find_right_miss", find_right_miss<C>);
+  add("iterate", iterate<C>);
+  add("flip", flip<C>);
+  add("copy", copy<C>);
+  add("teardown", teardown<C>);
+}
+} // namespace
+
+// Google benchmark runs benchmarks in the order they are registered, every
+// size of one before the next. Registering size by size and type by type
+// instead lets all benchmarks reading one filled container run in a row.
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  for (int64_t size = 1'000; size <= 10'000'000; size *= 10) {
+    register_benchmarks<int_bimap>("int_bimap", size);
+    benchmark::RegisterBenchmark("find_left_loop", find_left_loop)->Arg(size);
+    benchmark::RegisterBenchmark("find_left_batch", find_left_batch)
+        ->Arg(size);
+    register_benchmarks<ordered_pair>("ordered_pair", size);
+    register_benchmarks<unordered_pair>("unordered_pair", size);
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
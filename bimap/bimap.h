@@ -1,23 +1,43 @@
 #pragma once
 
+#include "bimap_instrumentation.h"
 #include "bimap_nodes.h"
+#include "bimap_parallel.h"
+#include "bimap_pool.h"
 #include "bimap_tree.h"
 #include <cassert>
+#include <algorithm>
 #include <cstddef>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Instrumentation = bimap_instrumentation::none>
 struct bimap {
 private:
   using left_t = Left;
   using right_t = Right;
 
+  using alloc_traits = std::allocator_traits<Allocator>;
+
   using tree_node_t = nodes::tree_node;
 
   using base_node_t = nodes::base_node;
   using node_t = nodes::node<left_t, right_t>;
 
+  using event = bimap_instrumentation::event;
+
   template <typename Tag>
   struct iterator {
     using value_type = std::conditional_t<nodes::is_left<Tag>, left_t, right_t>;
@@ -32,6 +52,8 @@ private:
     explicit iterator(tree_node_t* node) : node_(node) {}
 
   public:
+    iterator() = default;
+
     auto const& operator*() const {
       auto ptr = nodes::casts::tree_to_node<left_t, right_t, Tag>(node_);
       if constexpr (nodes::is_left<Tag>) {
@@ -64,6 +86,20 @@ private:
       return res;
     }
 
+    // O(log n) при BIMAP_ORDER_STATISTICS, иначе O(n)
+    iterator& operator+=(difference_type n) {
+      node_ = node_->advance(n);
+      return *this;
+    }
+    iterator& operator-=(difference_type n) {
+      return *this += -n;
+    }
+
+    friend difference_type operator-(iterator const& a, iterator const& b) {
+      return static_cast<difference_type>(a.node_->rank()) -
+             static_cast<difference_type>(b.node_->rank());
+    }
+
     iterator<other_tag> flip() const {
       return iterator<other_tag>(
           nodes::casts::node_to_tree<left_t, right_t, other_tag>(
@@ -81,72 +117,258 @@ private:
     friend struct bimap;
 
   private:
-    tree_node_t* node_;
+    tree_node_t* node_{nullptr};
   };
 
 public:
   using left_iterator = iterator<nodes::left_tag>;
   using right_iterator = iterator<nodes::right_tag>;
 
-  // Создает bimap не содержащий ни одной пары.
+  using allocator_type = Allocator;
+
+private:
+  using pool_t = bimap_pool::pool<node_t, Allocator>;
+  using group_t = typename pool_t::group_t;
+
+public:
+  // Пара, извлеченная из bimap вместе со своим узлом (см. extract_left).
+  // Элементы можно менять, пока узел вне bimap. Может пережить bimap, из
+  // которого извлечена.
+  struct node_type {
+    node_type() = default;
+
+    node_type(node_type&& other) noexcept
+        : node_(std::exchange(other.node_, nullptr)),
+          group_(std::exchange(other.group_, nullptr)),
+          alloc_(std::move(other.alloc_)) {}
+
+    node_type& operator=(node_type&& other) noexcept {
+      if (this != &other) {
+        reset();
+        node_ = std::exchange(other.node_, nullptr);
+        group_ = std::exchange(other.group_, nullptr);
+        alloc_ = std::move(other.alloc_);
+      }
+      return *this;
+    }
+
+    ~node_type() {
+      reset();
+    }
+
+    bool empty() const noexcept {
+      return node_ == nullptr;
+    }
+    explicit operator bool() const noexcept {
+      return !empty();
+    }
+
+    left_t& left() const {
+      return node_->l_element;
+    }
+    right_t& right() const {
+      return node_->r_element;
+    }
+
+    allocator_type get_allocator() const {
+      return *alloc_;
+    }
+
+  private:
+    node_type(node_t* node, group_t* group, Allocator const& alloc)
+        : node_(node), group_(group), alloc_(alloc) {}
+
+    // the node has left the handle
+    void release() noexcept {
+      node_ = nullptr;
+      group_t::release(std::exchange(group_, nullptr));
+    }
+
+    void reset() noexcept {
+      if (node_ != nullptr) {
+        node_->~node_t();
+        pool_t::abandon(std::exchange(group_, nullptr), *alloc_, node_);
+        node_ = nullptr;
+      }
+    }
+
+    friend struct bimap;
+
+    node_t* node_{nullptr};
+    group_t* group_{nullptr};
+    std::optional<Allocator> alloc_;
+  };
+
+  // Создает bimap не содержащий ни одной пары. Компараторы могут быть как
+  // обычными (как std::less), так и трехсторонними (как
+  // std::compare_three_way) -- тогда поиск сравнивает ключ с каждым узлом
+  // один раз.
   explicit bimap(CompareLeft compare_left = CompareLeft(),
-                 CompareRight compare_right = CompareRight())
+                 CompareRight compare_right = CompareRight(),
+                 Allocator const& alloc = Allocator())
       : left_tree_(std::move(compare_left), get_left(&fake_)),
-        right_tree_(std::move(compare_right), get_right(&fake_)) {}
+        right_tree_(std::move(compare_right), get_right(&fake_)),
+        pool_(alloc) {}
+
+  explicit bimap(Allocator const& alloc)
+      : bimap(CompareLeft(), CompareRight(), alloc) {}
+
+  // Создает bimap из диапазона пар (std::pair, std::tuple, ...). Если пары
+  // отсортированы по левым элементам, оба дерева строятся сразу
+  // сбалансированными: левое за O(n), правое -- после сортировки указателей
+  // на пары по правым элементам, сами элементы при этом не копируются.
+  // Неотсортированный диапазон тоже допустим. Из пар с одинаковым left_
+  // остается первая, из пар с одинаковым right_ -- с наименьшим left_.
+  template <std::input_iterator InputIt>
+  bimap(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+        CompareRight compare_right = CompareRight(),
+        Allocator const& alloc = Allocator())
+      : bimap(std::move(compare_left), std::move(compare_right), alloc) {
+    build_from(first, last);
+  }
 
   // Конструкторы от других и присваивания
   bimap(bimap const& other)
+      : bimap(other, alloc_traits::select_on_container_copy_construction(
+                         other.get_allocator())) {}
+
+  bimap(bimap const& other, Allocator const& alloc)
       : bimap(*static_cast<CompareLeft const*>(&other.left_tree_),
-              *static_cast<CompareRight const*>(&other.right_tree_)) {
-    left_tree_.fake_ = get_left(&fake_);
-    right_tree_.fake_ = get_right(&fake_);
-    try {
-      for (left_iterator it = other.begin_left(); it != other.end_left();
-           it++) {
-        insert(*it, *(it.flip()));
-      }
-    } catch (...) {
-      erase_left(begin_left(), end_left());
-      throw;
-    }
+              *static_cast<CompareRight const*>(&other.right_tree_), alloc) {
+    clone_from(other);
   }
 
   bimap(bimap&& other) noexcept
       : bimap(std::move(*static_cast<CompareLeft*>(&other.left_tree_)),
-              std::move(*static_cast<CompareRight*>(&other.right_tree_))) {
-    size_ = other.size_;
-    fake_ = std::move(other.fake_);
-    left_tree_.fake_ = get_left(&fake_);
-    right_tree_.fake_ = get_right(&fake_);
-    other.size_ = 0;
+              std::move(*static_cast<CompareRight*>(&other.right_tree_)),
+              other.get_allocator()) {
+    steal_nodes(other);
+  }
+
+  // Если аллокаторы различны, элементы other перемещаются по одному
+  bimap(bimap&& other, Allocator const& alloc)
+      : bimap(std::move(*static_cast<CompareLeft*>(&other.left_tree_)),
+              std::move(*static_cast<CompareRight*>(&other.right_tree_)),
+              alloc) {
+    if (get_allocator() == other.get_allocator()) {
+      steal_nodes(other);
+      return;
+    }
+    for (left_iterator it = other.begin_left(); it != other.end_left(); it++) {
+      node_t* node = node_from_left(it.node_);
+      insert_impl(std::move(node->l_element), std::move(node->r_element));
+    }
+    other.clear();
   }
 
   bimap& operator=(bimap const& other) {
     if (this == &other) {
       return *this;
     }
-    bimap(other).swap(*this);
+    if constexpr (alloc_traits::propagate_on_container_copy_assignment::value) {
+      bimap(other, other.get_allocator()).swap_contents(*this);
+    } else {
+      bimap(other, get_allocator()).swap_contents(*this);
+    }
     return *this;
   }
-  bimap& operator=(bimap&& other) noexcept {
+  bimap& operator=(bimap&& other) noexcept(
+      alloc_traits::propagate_on_container_move_assignment::value ||
+      alloc_traits::is_always_equal::value) {
     if (this == &other) {
       return *this;
     }
-    swap(other);
+    if constexpr (alloc_traits::propagate_on_container_move_assignment::value ||
+                  alloc_traits::is_always_equal::value) {
+      swap_contents(other);
+    } else if (get_allocator() == other.get_allocator()) {
+      swap_contents(other);
+    } else {
+      bimap(std::move(other), get_allocator()).swap_contents(*this);
+    }
     return *this;
   }
 
+  // Аллокаторы обмениваются только при propagate_on_container_swap, иначе
+  // они должны быть равны
   void swap(bimap& other) {
-    std::swap(size_, other.size_);
-    std::swap(left_tree_, other.left_tree_);
-    std::swap(right_tree_, other.right_tree_);
-    std::swap(fake_, other.fake_);
+    assert(alloc_traits::propagate_on_container_swap::value ||
+           get_allocator() == other.get_allocator());
+    swap_contents(other);
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(pool_.get_allocator());
+  }
+
+  // Копии компараторов, которыми упорядочены левые и правые элементы
+  CompareLeft left_comparator() const {
+    return *static_cast<CompareLeft const*>(&left_tree_);
+  }
+  CompareRight right_comparator() const {
+    return *static_cast<CompareRight const*>(&right_tree_);
   }
+
   // Деструктор. Вызывается при удалении объектов bimap.
   // Инвалидирует все итераторы ссылающиеся на элементы этого bimap
   // (включая итераторы ссылающиеся на элементы следующие за последними).
   ~bimap() {
-    erase_left(begin_left(), end_left());
+#if BIMAP_NODE_POOL
+    // the pool releases whole slabs, only the elements need destroying
+    if constexpr (!std::is_trivially_destructible_v<node_t>) {
+      left_tree_.clear(
+          [](tree_node_t* ptr) { node_from_left(ptr)->~node_t(); });
+    }
+#else
+    clear();
+#endif
+  }
+
+  // Что bimap успел сделать и как выглядят его деревья. Счетчики операций
+  // ведет Instrumentation: с bimap_instrumentation::counting они считаются
+  // (атомарно, так что искать можно из нескольких потоков), а с
+  // bimap_instrumentation::none по умолчанию нулевые и ничего не стоят.
+  // Форма деревьев считается при каждом вызове за O(n).
+  struct statistics {
+    struct side {
+      size_t height_;         // число уровней дерева
+      double average_depth_;  // средняя глубина узла, корень на глубине 1
+      size_t node_bytes_;     // ссылки и элементы стороны, без выравнивания
+      size_t comparisons_;
+      size_t lookups_;        // спусков от корня
+      size_t visits_;         // узлов, пройденных этими спусками
+    };
+
+    side left_;
+    side right_;
+    size_t inserts_;
+    size_t erases_;
+    size_t finds_;
+    size_t allocations_;  // созданных узлов
+    // байт под узлы, вместе со свободными местами; узлы, пришедшие из
+    // других bimap через insert(node_type&&) и merge, лежат в чужих блоках
+    // и не учитываются
+    size_t memory_;
+  };
+
+  statistics stats() const {
+    statistics res{};
+    res.left_ = side_stats(left_tree_, sizeof(left_t));
+    res.right_ = side_stats(right_tree_, sizeof(right_t));
+    res.inserts_ = instrumentation_.get(event::insert);
+    res.erases_ = instrumentation_.get(event::erase);
+    res.finds_ = instrumentation_.get(event::find);
+    res.allocations_ = instrumentation_.get(event::allocation);
+    res.memory_ = pool_.memory(size_);
+    return res;
+  }
+
+  // Удаляет все пары за O(n), деревья при этом не перебалансируются
+  void clear() noexcept {
+    left_tree_.clear(
+        [this](tree_node_t* ptr) { destroy_node(node_from_left(ptr)); });
+    right_tree_.fake_->left_ = right_tree_.fake_->right_ = nullptr;
+    size_ = 0;
   }
 
   // Вставка пары (left_, right_), возвращает итератор на left_.
@@ -165,6 +387,111 @@ public:
     return insert_impl(std::move(left), std::move(right));
   }
 
+  // Вставка с подсказками: пара вставляется как можно ближе к позициям
+  // hint_left и hint_right (сразу перед или сразу после них). Если подсказки
+  // верны, например при вставке в порядке возрастания с end_left() и
+  // end_right(), вставка выполняется за амортизированное O(1).
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       left_t const& left, right_t const& right) {
+    return insert_impl(hint_left, hint_right, left, right);
+  }
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       left_t const& left, right_t&& right) {
+    return insert_impl(hint_left, hint_right, left, std::move(right));
+  }
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       left_t&& left, right_t const& right) {
+    return insert_impl(hint_left, hint_right, std::move(left), right);
+  }
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       left_t&& left, right_t&& right) {
+    return insert_impl(hint_left, hint_right, std::move(left),
+                       std::move(right));
+  }
+
+  // Вставка извлеченного узла. Если left_ или right_ уже присутствуют,
+  // возвращается end_left(), а узел остается в nh. Иначе при равных
+  // аллокаторах узел вешается в деревья как есть, без выделения памяти и
+  // копирования элементов, а при разных элементы перемещаются в новый узел.
+  left_iterator insert(node_type&& nh) {
+    if (nh.empty()) {
+      return end_left();
+    }
+    node_t* node = nh.node_;
+    auto left_pos = left_tree_.find_insert_position(node->l_element);
+    if (left_pos.duplicate_ != nullptr) {
+      return end_left();
+    }
+    auto right_pos = right_tree_.find_insert_position(node->r_element);
+    if (right_pos.duplicate_ != nullptr) {
+      return end_left();
+    }
+    if (!(*nh.alloc_ == get_allocator())) {
+      left_iterator res =
+          link_new_node(left_pos, right_pos, std::move(node->l_element),
+                        std::move(node->r_element));
+      nh.reset();
+      return res;
+    }
+    check_room();
+    pool_.adopt(nh.group_);
+    nh.release();
+    return link_node(left_pos, right_pos, node);
+  }
+
+  // Извлекает пару, не уничтожая ее узел. Инвалидирует итераторы на пару.
+  node_type extract_left(left_iterator it) {
+    return extract_node(node_from_left(it.node_));
+  }
+  node_type extract_right(right_iterator it) {
+    return extract_node(node_from_right(it.node_));
+  }
+
+  // Переносит из other пары, ни один элемент которых еще не встречается в
+  // bimap, остальные остаются в other. При равных аллокаторах узлы
+  // перевешиваются без выделения памяти и копирования элементов, иначе
+  // элементы перемещаются по одному.
+  void merge(bimap& other) {
+    if (this == &other) {
+      return;
+    }
+    bool relink = get_allocator() == other.get_allocator();
+    if (relink) {
+      pool_.adopt(other.pool_);
+    }
+    for (left_iterator it = other.begin_left(); it != other.end_left();) {
+      node_t* node = node_from_left(it.node_);
+      auto left_pos = left_tree_.find_insert_position(node->l_element);
+      auto right_pos = right_tree_.find_insert_position(node->r_element);
+      if (left_pos.duplicate_ != nullptr || right_pos.duplicate_ != nullptr) {
+        ++it;
+        continue;
+      }
+      if (relink) {
+        check_room();
+        ++it;
+        other.erase_node(node);
+        other.size_--;
+        link_node(left_pos, right_pos, node);
+      } else {
+        link_new_node(left_pos, right_pos, std::move(node->l_element),
+                      std::move(node->r_element));
+        it = other.erase_left(it);
+      }
+    }
+  }
+  void merge(bimap&& other) {
+    merge(other);
+  }
+
+  // Заменяет содержимое bimap парами из диапазона, см. конструктор от
+  // диапазона. Если бросается исключение, bimap остается пустым.
+  template <std::input_iterator InputIt>
+  void assign_sorted(InputIt first, InputIt last) {
+    clear();
+    build_from(first, last);
+  }
+
   // Удаляет элемент и соответствующий ему парный.
   // erase невалидного итератора неопределен.
   // erase(end_left()) и erase(end_right()) неопределены.
@@ -173,85 +500,112 @@ public:
   left_iterator erase_left(left_iterator it) {
     left_iterator res = std::next(it);
     erase_node(node_from_left(it.node_));
-    delete node_from_left(it.node_);
+    destroy_node(node_from_left(it.node_));
     size_--;
     return res;
   }
   // Аналогично erase, но по ключу, удаляет элемент если он присутствует, иначе
   // не делает ничего Возвращает была ли пара удалена
   bool erase_left(left_t const& left) {
-    left_iterator it = find_left(left);
-    if (it == end_left()) {
-      return false;
-    }
-    erase_left(it);
-    return true;
+    return erase_key_impl<nodes::left_tag>(left);
+  }
+  // При прозрачном компараторе (is_transparent) ключ может быть любого типа,
+  // сравнимого с left_t, временный left_t не создается. Так же устроены
+  // остальные поиски по ключу ниже.
+  template <typename K>
+    requires(bimap_tree::transparent<CompareLeft> &&
+             !std::is_convertible_v<K const&, left_iterator>)
+  bool erase_left(K const& left) {
+    return erase_key_impl<nodes::left_tag>(left);
   }
 
   right_iterator erase_right(right_iterator it) {
     right_iterator res = std::next(it);
     erase_node(node_from_right(it.node_));
-    delete node_from_right(it.node_);
+    destroy_node(node_from_right(it.node_));
     size_--;
     return res;
   }
   bool erase_right(right_t const& right) {
-    right_iterator it = find_right(right);
-    if (it == end_right()) {
-      return false;
-    }
-    erase_right(it);
-    return true;
+    return erase_key_impl<nodes::right_tag>(right);
+  }
+  template <typename K>
+    requires(bimap_tree::transparent<CompareRight> &&
+             !std::is_convertible_v<K const&, right_iterator>)
+  bool erase_right(K const& right) {
+    return erase_key_impl<nodes::right_tag>(right);
   }
 
   // erase от ренжа, удаляет [first, last), возвращает итератор на последний
-  // элемент за удаленной последовательностью
+  // элемент за удаленной последовательностью. Длинный диапазон удаляется за
+  // O(n): оставшиеся узлы заново связываются в сбалансированные деревья.
   left_iterator erase_left(left_iterator first, left_iterator last) {
-    while (first != last) {
-      first = erase_left(first);
-    }
-    return first;
+    return erase_range_impl(first, last);
   }
   right_iterator erase_right(right_iterator first, right_iterator last) {
-    while (first != last) {
-      first = erase_right(first);
-    }
-    return first;
+    return erase_range_impl(first, last);
+  }
+
+  // Заменяет левый элемент пары, на которую указывает it, на key. Пара
+  // переставляется только среди левых элементов, а если key встает на то же
+  // место -- не переставляется вовсе. Если key уже есть у другой пары, ничего
+  // не меняет и возвращает end_left(), иначе возвращает it. Итераторы на
+  // пару остаются валидными.
+  left_iterator replace_left(left_iterator it, left_t key) {
+    return replace_impl(it, std::move(key));
+  }
+  right_iterator replace_right(right_iterator it, right_t key) {
+    return replace_impl(it, std::move(key));
   }
 
   // Возвращает итератор по элементу. Если не найден - соответствующий end()
   left_iterator find_left(left_t const& left) const {
-    tree_node_t* ptr = left_tree_.find(left);
-    if (ptr == left_tree_.fake_ ||
-        !eq_left(node_from_left(ptr)->l_element, left)) {
-      return end_left();
-    }
-    return left_iterator(ptr);
+    return find_impl<nodes::left_tag>(left);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareLeft>
+  left_iterator find_left(K const& left) const {
+    return find_impl<nodes::left_tag>(left);
   }
   right_iterator find_right(right_t const& right) const {
-    tree_node_t* ptr = right_tree_.find(right);
-    if (ptr == right_tree_.fake_ ||
-        !eq_right(node_from_right(ptr)->r_element, right)) {
-      return end_right();
-    }
-    return right_iterator(ptr);
+    return find_impl<nodes::right_tag>(right);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareRight>
+  right_iterator find_right(K const& right) const {
+    return find_impl<nodes::right_tag>(right);
+  }
+
+  // Поиск многих ключей сразу: out[i] = find_left(keys[i]). Если out короче
+  // keys -- бросает std::length_error, ничего не записав. Спуски по дереву
+  // для разных ключей чередуются, а узлы подгружаются в кэш заранее, поэтому
+  // на больших bimap это заметно быстрее цикла из find_left.
+  void find_left_batch(std::span<left_t const> keys,
+                       std::span<left_iterator> out) const {
+    find_batch_impl<nodes::left_tag>(keys, out);
+  }
+  void find_right_batch(std::span<right_t const> keys,
+                        std::span<right_iterator> out) const {
+    find_batch_impl<nodes::right_tag>(keys, out);
   }
 
   // Возвращает противоположный элемент по элементу
   // Если элемента не существует -- бросает std::out_of_range
   right_t const& at_left(left_t const& key) const {
-    left_iterator it = find_left(key);
-    if (it == end_left()) {
-      throw std::out_of_range("No such key");
-    }
-    return *(it.flip());
+    return at_impl<nodes::left_tag>(key);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareLeft>
+  right_t const& at_left(K const& key) const {
+    return at_impl<nodes::left_tag>(key);
   }
   left_t const& at_right(right_t const& key) const {
-    right_iterator it = find_right(key);
-    if (it == end_right()) {
-      throw std::out_of_range("No such key");
-    }
-    return *(it.flip());
+    return at_impl<nodes::right_tag>(key);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareRight>
+  left_t const& at_right(K const& key) const {
+    return at_impl<nodes::right_tag>(key);
   }
 
   // Возвращает противоположный элемент по элементу
@@ -272,9 +626,7 @@ public:
     if (it_r == end_right()) {
       return *(insert(key, std::move(tmp)).flip());
     } else {
-      erase_node(node_from_right(it_r.node_));
-      node_from_right(it_r.node_)->l_element = key;
-      insert_node(node_from_right(it_r.node_));
+      replace_left(it_r.flip(), key);
       return *it_r;
     }
   }
@@ -292,9 +644,7 @@ public:
     if (it_l == end_left()) {
       return *insert(std::move(tmp), key);
     } else {
-      erase_node(node_from_left(it_l.node_));
-      node_from_left(it_l.node_)->r_element = key;
-      insert_node(node_from_left(it_l.node_));
+      replace_right(it_l.flip(), key);
       return *it_l;
     }
   }
@@ -303,37 +653,63 @@ public:
   // Возвращают итераторы на соответствующие элементы
   // Смотри std::lower_bound, std::upper_bound.
   left_iterator lower_bound_left(const left_t& left) const {
-    tree_node_t* ptr = left_tree_.find(left);
-    left_iterator it(ptr);
-    if (it == end_left() || eq_left(*it, left) || cmp_left(left, *it)) {
-      return it;
-    }
-    return ++it;
+    return lower_bound_impl<nodes::left_tag>(left);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareLeft>
+  left_iterator lower_bound_left(K const& left) const {
+    return lower_bound_impl<nodes::left_tag>(left);
   }
   left_iterator upper_bound_left(const left_t& left) const {
-    tree_node_t* ptr = left_tree_.find(left);
-    left_iterator it(ptr);
-    if (it == end_left() || cmp_left(left, *it)) {
-      return it;
-    }
-    return ++it;
+    return upper_bound_impl<nodes::left_tag>(left);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareLeft>
+  left_iterator upper_bound_left(K const& left) const {
+    return upper_bound_impl<nodes::left_tag>(left);
   }
 
   right_iterator lower_bound_right(const right_t& right) const {
-    tree_node_t* ptr = right_tree_.find(right);
-    right_iterator it(ptr);
-    if (it == end_right() || eq_right(*it, right) || cmp_right(right, *it)) {
-      return it;
-    }
-    return ++it;
+    return lower_bound_impl<nodes::right_tag>(right);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareRight>
+  right_iterator lower_bound_right(K const& right) const {
+    return lower_bound_impl<nodes::right_tag>(right);
   }
   right_iterator upper_bound_right(const right_t& right) const {
-    tree_node_t* ptr = right_tree_.find(right);
-    right_iterator it(ptr);
-    if (it == end_right() || cmp_right(right, *it)) {
-      return it;
-    }
-    return ++it;
+    return upper_bound_impl<nodes::right_tag>(right);
+  }
+  template <typename K>
+    requires bimap_tree::transparent<CompareRight>
+  right_iterator upper_bound_right(K const& right) const {
+    return upper_bound_impl<nodes::right_tag>(right);
+  }
+
+  // Порядковые статистики. nth_left(k) -- итератор на k-й по порядку left_
+  // (end_left(), если k >= size()), rank_left(it) -- количество элементов
+  // перед it. При BIMAP_ORDER_STATISTICS (по умолчанию) узлы хранят размеры
+  // поддеревьев и все это работает за O(log n), иначе за O(n).
+  left_iterator nth_left(size_t k) const {
+    return left_iterator(left_tree_.fake_->select(k));
+  }
+  right_iterator nth_right(size_t k) const {
+    return right_iterator(right_tree_.fake_->select(k));
+  }
+
+  size_t rank_left(left_iterator it) const {
+    return it.node_->rank();
+  }
+  size_t rank_right(right_iterator it) const {
+    return it.node_->rank();
+  }
+
+  // Количество элементов в [from, to)
+  size_t count_range_left(left_t const& from, left_t const& to) const {
+    return count_range_impl<nodes::left_tag>(from, to);
+  }
+  size_t count_range_right(right_t const& from, right_t const& to) const {
+    return count_range_impl<nodes::right_tag>(from, to);
   }
 
   // Возващает итератор на минимальный по порядку left_.
@@ -364,6 +740,11 @@ public:
     return size_;
   }
 
+  // Наибольший возможный размер, при BIMAP_COMPACT_NODES -- 2^32 - 1
+  std::size_t max_size() const {
+    return std::numeric_limits<tree_node_t::count_t>::max();
+  }
+
   // операторы сравнения
   friend bool operator==(bimap const& a, bimap const& b) {
     if (a.size() != b.size()) {
@@ -381,25 +762,688 @@ public:
     return !(a == b);
   }
 
+  // Операции над множествами пар. Пары a и b перебираются по возрастанию
+  // левых элементов, диапазон левых режется на куски, которые обходятся в
+  // threads потоках, результат строится конструктором от отсортированного
+  // диапазона, а не вставками по одной. Компараторы и аллокатор результата
+  // берутся из a. Компараторы b должны упорядочивать элементы так же, как
+  // компараторы a (например, быть того же типа с тем же состоянием), иначе
+  // результат не определен; отладочная сборка это проверяет. Пока операция
+  // идет, a и b нельзя изменять.
+
+  // Все пары a и те пары b, у которых ни левый, ни правый элемент не
+  // встречаются в a (как в merge).
+  friend bimap set_union(bimap const& a, bimap const& b,
+                         size_t threads = std::thread::hardware_concurrency()) {
+    return a.from_parts(join_in_chunks<pairs_t>(
+        a, b, threads, [&](auto i, auto ie, auto j, auto je, pairs_t& out) {
+          a.join_lefts(
+              i, ie, j, je, [&](left_iterator it) { push_pair(out, it); },
+              [&](left_iterator it) {
+                if (a.find_right(*it.flip()) == a.end_right()) {
+                  push_pair(out, it);
+                }
+              },
+              [&](left_iterator it, left_iterator) { push_pair(out, it); });
+        }));
+  }
+
+  // Пары, которые есть и в a, и в b
+  friend bimap set_intersection(
+      bimap const& a, bimap const& b,
+      size_t threads = std::thread::hardware_concurrency()) {
+    return a.from_parts(join_in_chunks<pairs_t>(
+        a, b, threads, [&](auto i, auto ie, auto j, auto je, pairs_t& out) {
+          a.join_lefts(
+              i, ie, j, je, [](left_iterator) {}, [](left_iterator) {},
+              [&](left_iterator it, left_iterator other) {
+                if (a.eq_right(*it.flip(), *other.flip())) {
+                  push_pair(out, it);
+                }
+              });
+        }));
+  }
+
+  // Пары a, которых нет в b
+  friend bimap set_difference(
+      bimap const& a, bimap const& b,
+      size_t threads = std::thread::hardware_concurrency()) {
+    return a.from_parts(join_in_chunks<pairs_t>(
+        a, b, threads, [&](auto i, auto ie, auto j, auto je, pairs_t& out) {
+          a.join_lefts(
+              i, ie, j, je, [&](left_iterator it) { push_pair(out, it); },
+              [](left_iterator) {},
+              [&](left_iterator it, left_iterator other) {
+                if (!a.eq_right(*it.flip(), *other.flip())) {
+                  push_pair(out, it);
+                }
+              });
+        }));
+  }
+
+  // Чем after отличается от before, по левым элементам: все списки
+  // отсортированы по левым.
+  struct changes {
+    // пары after, левых элементов которых нет в before
+    std::vector<std::pair<left_t, right_t>> added_;
+    // пары before, левых элементов которых нет в after
+    std::vector<std::pair<left_t, right_t>> removed_;
+    // левый элемент, правый в before и правый в after, если они разные
+    std::vector<std::tuple<left_t, right_t, right_t>> changed_;
+  };
+
+  friend changes diff(bimap const& before, bimap const& after,
+                      size_t threads = std::thread::hardware_concurrency()) {
+    auto parts = join_in_chunks<changes>(
+        before, after, threads,
+        [&](auto i, auto ie, auto j, auto je, changes& out) {
+          before.join_lefts(
+              i, ie, j, je,
+              [&](left_iterator it) { push_pair(out.removed_, it); },
+              [&](left_iterator it) { push_pair(out.added_, it); },
+              [&](left_iterator it, left_iterator other) {
+                if (!before.eq_right(*it.flip(), *other.flip())) {
+                  out.changed_.emplace_back(*it, *it.flip(), *other.flip());
+                }
+              });
+        });
+    changes res;
+    for (changes& part : parts) {
+      append(res.added_, part.added_);
+      append(res.removed_, part.removed_);
+      append(res.changed_, part.changed_);
+    }
+    return res;
+  }
+
 private:
+  void steal_nodes(bimap& other) noexcept {
+    size_ = std::exchange(other.size_, 0);
+    fake_ = std::move(other.fake_);
+    pool_.swap(other.pool_);
+  }
+
+  void swap_contents(bimap& other) {
+    std::swap(size_, other.size_);
+    std::swap(left_tree_, other.left_tree_);
+    std::swap(right_tree_, other.right_tree_);
+    std::swap(fake_, other.fake_);
+    pool_.swap(other.pool_);
+  }
+
+  template <typename Tag>
+  auto const& tree_of() const {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_tree_;
+    } else {
+      return right_tree_;
+    }
+  }
+
+  template <typename Tag>
+  auto& tree_of() {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_tree_;
+    } else {
+      return right_tree_;
+    }
+  }
+
+  template <typename Tag, typename K>
+  iterator<Tag> find_impl(K const& key) const {
+    count_finds(1);
+    return iterator<Tag>(tree_of<Tag>().find(key));
+  }
+
+  template <typename Tag, typename K>
+  void find_batch_impl(std::span<K const> keys,
+                       std::span<iterator<Tag>> out) const {
+    if (out.size() < keys.size()) {
+      throw std::length_error("batch output is shorter than its keys");
+    }
+    count_finds(keys.size());
+    tree_of<Tag>().find_batch(
+        keys.data(), keys.size(),
+        [&](size_t i, tree_node_t* node) { out[i] = iterator<Tag>(node); });
+  }
+
+  template <typename Tag, typename K>
+  auto const& at_impl(K const& key) const {
+    iterator<Tag> it = find_impl<Tag>(key);
+    if (it.node_ == tree_of<Tag>().fake_) {
+      throw std::out_of_range("No such key");
+    }
+    return *(it.flip());
+  }
+
+  template <typename Tag, typename K>
+  bool erase_key_impl(K const& key) {
+    iterator<Tag> it = find_impl<Tag>(key);
+    if (it.node_ == tree_of<Tag>().fake_) {
+      return false;
+    }
+    if constexpr (nodes::is_left<Tag>) {
+      erase_left(it);
+    } else {
+      erase_right(it);
+    }
+    return true;
+  }
+
+  template <typename Tag>
+  iterator<Tag> erase_range_impl(iterator<Tag> first, iterator<Tag> last) {
+    if (first == last) {
+      return last;
+    }
+    auto const& tree = tree_of<Tag>();
+    if (first.node_ == tree.fake_->minimum() && last.node_ == tree.fake_) {
+      count_erases(size_);
+      clear();
+      return last;
+    }
+    // one by one erasing costs O(log n) per pair, relinking O(n) in total
+    size_t limit = size_ / std::bit_width(size_);
+    iterator<Tag> it = first;
+    for (size_t k = 0; it != last && k < limit; k++) {
+      ++it;
+    }
+    if (it != last) {
+      try {
+        relink_without(first, last);
+        return last;
+      } catch (std::bad_alloc const&) {
+        // not enough memory to sort the nodes, fall back to erasing them
+      }
+    }
+    while (first != last) {
+      if constexpr (nodes::is_left<Tag>) {
+        first = erase_left(first);
+      } else {
+        first = erase_right(first);
+      }
+    }
+    return last;
+  }
+
+  // Erases [first, last) by building both trees anew from the remaining
+  // nodes. The nodes being erased are marked by clearing the parent of
+  // their Tag side, which is relinked anyway.
+  template <typename Tag>
+  void relink_without(iterator<Tag> first, iterator<Tag> last) {
+    using other_tag = std::conditional_t<nodes::is_left<Tag>, nodes::right_tag,
+                                         nodes::left_tag>;
+    auto const& own_tree = tree_of<Tag>();
+    auto const& other_tree = tree_of<other_tag>();
+    std::vector<node_t*> own;
+    std::vector<node_t*> other;
+    std::vector<node_t*> erased;
+    own.reserve(size_);
+    other.reserve(size_);
+    for (iterator<Tag> it(own_tree.fake_->minimum()); it != first; ++it) {
+      own.push_back(get_node<Tag>(it.node_));
+    }
+    for (; first != last; ++first) {
+      erased.push_back(get_node<Tag>(first.node_));
+    }
+    for (; last.node_ != own_tree.fake_; ++last) {
+      own.push_back(get_node<Tag>(last.node_));
+    }
+
+    for (node_t* node : erased) {
+      nodes::casts::node_to_tree<left_t, right_t, Tag>(node)->set_parent(
+          nullptr);
+    }
+    for (iterator<other_tag> it(other_tree.fake_->minimum());
+         it.node_ != other_tree.fake_; ++it) {
+      node_t* node = get_node<other_tag>(it.node_);
+      if (nodes::casts::node_to_tree<left_t, right_t, Tag>(node)->parent() !=
+          nullptr) {
+        other.push_back(node);
+      }
+    }
+
+    auto& lefts = nodes::is_left<Tag> ? own : other;
+    auto& rights = nodes::is_left<Tag> ? other : own;
+    left_tree_.fake_->left_ = left_tree_.fake_->right_ = nullptr;
+    right_tree_.fake_->left_ = right_tree_.fake_->right_ = nullptr;
+    left_tree_.build(lefts.begin(), lefts.size(),
+                     [](node_t* ptr) { return get_left(ptr); });
+    right_tree_.build(rights.begin(), rights.size(),
+                      [](node_t* ptr) { return get_right(ptr); });
+    size_ = own.size();
+    count_erases(erased.size());
+    for (node_t* node : erased) {
+      destroy_node(node);
+    }
+  }
+
+  // All comparisons are made before anything changes: the new place is
+  // remembered as the node the key goes before, which stays right when this
+  // node is unlinked, so a throwing comparator leaves the bimap as it was.
+  // Once the key is assigned, nothing else can throw.
+  template <typename Tag, typename K>
+  iterator<Tag> replace_impl(iterator<Tag> it, K&& key) {
+    auto& tree = tree_of<Tag>();
+    bool stays = tree.fits(it.node_, key);
+    tree_node_t* next = tree.fake_;
+    if (!stays) {
+      next = tree.lower_bound(key);
+      if (next != tree.fake_ && !tree.compare(key, tree.get_elem(next))) {
+        return iterator<Tag>(tree.fake_);
+      }
+    }
+    auto node = nodes::casts::tree_to_node<left_t, right_t, Tag>(it.node_);
+    if constexpr (nodes::is_left<Tag>) {
+      node->l_element = std::forward<K>(key);
+    } else {
+      node->r_element = std::forward<K>(key);
+    }
+    if (!stays) {
+      tree.erase(it.node_);
+      tree.insert_at(tree.position_before(next), it.node_);
+    }
+    return it;
+  }
+
+  template <typename Tag, typename K>
+  iterator<Tag> lower_bound_impl(K const& key) const {
+    return iterator<Tag>(tree_of<Tag>().lower_bound(key));
+  }
+
+  template <typename Tag, typename K>
+  iterator<Tag> upper_bound_impl(K const& key) const {
+    return iterator<Tag>(tree_of<Tag>().upper_bound(key));
+  }
+
+  template <typename Tag, typename K>
+  size_t count_range_impl(K const& from, K const& to) const {
+    if (!tree_of<Tag>().compare(from, to)) {
+      return 0;
+    }
+    return lower_bound_impl<Tag>(to) - lower_bound_impl<Tag>(from);
+  }
+
+  using pairs_t = std::vector<std::pair<left_t, right_t>>;
+
+  static void push_pair(pairs_t& out, left_iterator it) {
+    out.emplace_back(*it, *it.flip());
+  }
+
+  template <typename T>
+  static void append(std::vector<T>& to, std::vector<T>& from) {
+    if (to.empty()) {
+      to = std::move(from);
+    } else {
+      to.insert(to.end(), std::make_move_iterator(from.begin()),
+                std::make_move_iterator(from.end()));
+    }
+  }
+
+  // Merge join of [i, ie) of this bimap with [j, je) of a bimap ordering
+  // lefts the same way: calls only_this(i), only_other(j) or both(i, j) for
+  // every left, in order.
+  template <typename OnlyThis, typename OnlyOther, typename Both>
+  void join_lefts(left_iterator i, left_iterator ie, left_iterator j,
+                  left_iterator je, OnlyThis only_this, OnlyOther only_other,
+                  Both both) const {
+    while (i != ie && j != je) {
+      if (cmp_left(*i, *j)) {
+        only_this(i++);
+      } else if (cmp_left(*j, *i)) {
+        only_other(j++);
+      } else {
+        both(i++, j++);
+      }
+    }
+    for (; i != ie; ++i) {
+      only_this(i);
+    }
+    for (; j != je; ++j) {
+      only_other(j);
+    }
+  }
+
+  // Splits the left order of a and b at the same keys and calls
+  // join(a_first, a_last, b_first, b_last, part) for every chunk on its own
+  // thread. Lookups only read the trees, and the instrumentation counters
+  // are atomic.
+  template <typename Part, typename Join>
+  static std::vector<Part> join_in_chunks(bimap const& a, bimap const& b,
+                                          size_t threads, Join const& join) {
+    // b is merged with a's comparator, so it has to be sorted by it as well
+    assert(std::is_sorted(
+        b.begin_left(), b.end_left(),
+        [&a](left_t const& x, left_t const& y) { return a.cmp_left(x, y); }));
+    size_t chunks = bimap_parallel::chunk_count(a.size() + b.size(), threads);
+    bimap const& big = a.size() >= b.size() ? a : b;
+    std::vector<left_iterator> a_bounds{a.begin_left()};
+    std::vector<left_iterator> b_bounds{b.begin_left()};
+    for (size_t k = 1; k < chunks; k++) {
+      left_t const& split = *big.nth_left(k * big.size() / chunks);
+      a_bounds.push_back(a.lower_bound_left(split));
+      b_bounds.push_back(b.lower_bound_left(split));
+    }
+    a_bounds.push_back(a.end_left());
+    b_bounds.push_back(b.end_left());
+    std::vector<Part> parts(chunks);
+    bimap_parallel::for_each_chunk(chunks, [&](size_t k) {
+      join(a_bounds[k], a_bounds[k + 1], b_bounds[k], b_bounds[k + 1],
+           parts[k]);
+    });
+    return parts;
+  }
+
+  // The chunks hold pairs sorted by left, so the result is linked in O(n)
+  // on the left side.
+  bimap from_parts(std::vector<pairs_t> parts) const {
+    pairs_t all;
+    for (pairs_t& part : parts) {
+      append(all, part);
+    }
+    return bimap(std::make_move_iterator(all.begin()),
+                 std::make_move_iterator(all.end()),
+                 left_comparator(), right_comparator(),
+                 alloc_traits::select_on_container_copy_construction(
+                     get_allocator()));
+  }
+
+  // Maps nodes of the bimap being copied to their copies, open addressing
+  // over a power of two number of slots, at most half of them used.
+  struct clone_map {
+    explicit clone_map(size_t size)
+        : slots_(std::bit_ceil(2 * size)),
+          shift_(64 - std::countr_zero(slots_.size())) {}
+
+    void insert(node_t* from, node_t* to) {
+      size_t i = index(from);
+      while (slots_[i].first != nullptr) {
+        i = (i + 1) & (slots_.size() - 1);
+      }
+      slots_[i] = {from, to};
+    }
+
+    node_t* operator[](node_t* from) const {
+      size_t i = index(from);
+      while (slots_[i].first != from) {
+        i = (i + 1) & (slots_.size() - 1);
+      }
+      return slots_[i].second;
+    }
+
+    std::vector<std::pair<node_t*, node_t*>> const& slots() const {
+      return slots_;
+    }
+
+  private:
+    // fibonacci hashing, the low bits of a node address carry no information
+    size_t index(node_t* ptr) const {
+      uint64_t key = reinterpret_cast<uintptr_t>(ptr);
+      return (key * 0x9E3779B97F4A7C15ull) >> shift_;
+    }
+
+    std::vector<std::pair<node_t*, node_t*>> slots_;
+    int shift_;
+  };
+
+  // this must be empty. Copies the elements of other and links the copies
+  // exactly like other's nodes are linked, no keys are compared.
+  void clone_from(bimap const& other) {
+    if (other.empty()) {
+      return;
+    }
+    check_room(other.size_);
+    clone_map copies(other.size_);
+    try {
+      for (left_iterator it = other.begin_left(); it != other.end_left();
+           it++) {
+        node_t* from = node_from_left(it.node_);
+        copies.insert(from, create_node(from->l_element, from->r_element));
+      }
+    } catch (...) {
+      for (auto [from, to] : copies.slots()) {
+        if (to != nullptr) {
+          destroy_node(to);
+        }
+      }
+      throw;
+    }
+    for (auto [from, to] : copies.slots()) {
+      if (from != nullptr) {
+        clone_links<nodes::left_tag>(copies, from, to);
+        clone_links<nodes::right_tag>(copies, from, to);
+      }
+    }
+    clone_fake_links<nodes::left_tag>(copies, other.left_tree_.fake_,
+                                      left_tree_.fake_);
+    clone_fake_links<nodes::right_tag>(copies, other.right_tree_.fake_,
+                                       right_tree_.fake_);
+    size_ = other.size_;
+  }
+
+  template <typename Tag>
+  void clone_links(clone_map const& copies, node_t* from, node_t* to) {
+    tree_node_t* src = nodes::casts::node_to_tree<left_t, right_t, Tag>(from);
+    tree_node_t* dst = nodes::casts::node_to_tree<left_t, right_t, Tag>(to);
+    dst->left_ = clone_link<Tag>(copies, src->left_);
+    dst->right_ = clone_link<Tag>(copies, src->right_);
+    dst->set_parent(clone_link<Tag>(copies, src->parent()));
+    dst->set_red(src->red());
+#if BIMAP_ORDER_STATISTICS
+    dst->count_ = src->count_;
+#endif
+  }
+
+  template <typename Tag>
+  void clone_fake_links(clone_map const& copies, tree_node_t* src,
+                        tree_node_t* dst) {
+    dst->left_ = clone_link<Tag>(copies, src->left_);
+    dst->right_ = clone_link<Tag>(copies, src->right_);
+  }
+
+  // the copy of a link between other's nodes, other's fake node is the only
+  // node without a parent
+  template <typename Tag>
+  tree_node_t* clone_link(clone_map const& copies, tree_node_t* ptr) {
+    if (ptr == nullptr) {
+      return nullptr;
+    }
+    if (ptr->parent() == nullptr) {
+      return nodes::casts::base_to_tree<Tag>(&fake_);
+    }
+    return nodes::casts::node_to_tree<left_t, right_t, Tag>(
+        copies[get_node<Tag>(ptr)]);
+  }
+
+  // this must be empty
+  template <typename InputIt>
+  void build_from(InputIt first, InputIt last) {
+    std::vector<node_t*> order;
+    if constexpr (std::forward_iterator<InputIt>) {
+      order.reserve(std::distance(first, last));
+    }
+    try {
+      for (; first != last; ++first) {
+        auto&& pair = *first;
+        order.push_back(
+            create_node(std::get<0>(std::forward<decltype(pair)>(pair)),
+                        std::get<1>(std::forward<decltype(pair)>(pair))));
+      }
+      link_sorted(order);
+    } catch (...) {
+      for (node_t* node : order) {
+        if (node != nullptr) {
+          destroy_node(node);
+        }
+      }
+      left_tree_.fake_->left_ = left_tree_.fake_->right_ = nullptr;
+      right_tree_.fake_->left_ = right_tree_.fake_->right_ = nullptr;
+      size_ = 0;
+      throw;
+    }
+  }
+
+  // Links unlinked nodes into both (empty) trees. Nodes with duplicate keys
+  // are destroyed and removed from order, which always holds exactly the
+  // nodes owned by the caller.
+  void link_sorted(std::vector<node_t*>& order) {
+    auto left_less = [this](node_t* a, node_t* b) {
+      return cmp_left(a->l_element, b->l_element);
+    };
+    auto right_less = [this](node_t* a, node_t* b) {
+      return cmp_right(a->r_element, b->r_element);
+    };
+
+    if (!std::is_sorted(order.begin(), order.end(), left_less)) {
+      std::stable_sort(order.begin(), order.end(), left_less);
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+      if (kept != 0 && !left_less(order[kept - 1], order[i])) {
+        destroy_node(std::exchange(order[i], nullptr));
+      } else {
+        std::swap(order[kept++], order[i]);
+      }
+    }
+    order.resize(kept);
+    check_room(order.size());
+    left_tree_.build(order.begin(), order.size(),
+                     [](node_t* ptr) { return get_left(ptr); });
+    size_ = order.size();
+
+    if (!std::is_sorted(order.begin(), order.end(), right_less)) {
+      std::sort(order.begin(), order.end(), right_less);
+    }
+    kept = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+      if (kept != 0 && !right_less(order[kept - 1], order[i])) {
+        if (left_less(order[i], order[kept - 1])) {
+          std::swap(order[kept - 1], order[i]);
+        }
+        left_tree_.erase(get_left(order[i]));
+        size_--;
+        destroy_node(std::exchange(order[i], nullptr));
+      } else {
+        std::swap(order[kept++], order[i]);
+      }
+    }
+    order.resize(kept);
+    right_tree_.build(order.begin(), order.size(),
+                      [](node_t* ptr) { return get_right(ptr); });
+    count_inserts(order.size());
+  }
+
   template <typename A, typename B>
   left_iterator insert_impl(A&& left, B&& right) {
-    if (find_left(left) != end_left() || find_right(right) != end_right()) {
+    auto left_pos = left_tree_.find_insert_position(left);
+    if (left_pos.duplicate_ != nullptr) {
+      return end_left();
+    }
+    auto right_pos = right_tree_.find_insert_position(right);
+    if (right_pos.duplicate_ != nullptr) {
       return end_left();
     }
-    auto* node = new node_t(std::forward<A>(left), std::forward<B>(right));
-    insert_node(node);
+    return link_new_node(left_pos, right_pos, std::forward<A>(left),
+                         std::forward<B>(right));
+  }
+
+  template <typename A, typename B>
+  left_iterator insert_impl(left_iterator hint_left, right_iterator hint_right,
+                            A&& left, B&& right) {
+    auto left_pos = left_tree_.find_insert_position(hint_left.node_, left);
+    if (left_pos.duplicate_ != nullptr) {
+      return end_left();
+    }
+    auto right_pos = right_tree_.find_insert_position(hint_right.node_, right);
+    if (right_pos.duplicate_ != nullptr) {
+      return end_left();
+    }
+    return link_new_node(left_pos, right_pos, std::forward<A>(left),
+                         std::forward<B>(right));
+  }
+
+  template <typename A, typename B>
+  left_iterator link_new_node(bimap_tree::position left_pos,
+                              bimap_tree::position right_pos, A&& left,
+                              B&& right) {
+    check_room();
+    return link_node(
+        left_pos, right_pos,
+        create_node(std::forward<A>(left), std::forward<B>(right)));
+  }
+
+  // count more pairs still fit under max_size()
+  void check_room(size_t count = 1) const {
+    if (max_size() - size_ < count) {
+      throw std::length_error("bimap is too large");
+    }
+  }
+
+  left_iterator link_node(bimap_tree::position left_pos,
+                          bimap_tree::position right_pos, node_t* node) {
+    left_tree_.insert_at(left_pos, get_left(node));
+    right_tree_.insert_at(right_pos, get_right(node));
     size_++;
+    count_inserts(1);
     return left_iterator(get_left(node));
   }
 
+  // sharing the slabs may allocate, so it goes before the node is unlinked
+  node_type extract_node(node_t* node) {
+    group_t* group = pool_.share();
+    erase_node(node);
+    size_--;
+    return node_type(node, group, get_allocator());
+  }
+
+  template <typename A, typename B>
+  node_t* create_node(A&& left, B&& right) {
+    void* place = pool_.allocate();
+    count_allocations(1);
+    try {
+      return new (place) node_t(std::forward<A>(left), std::forward<B>(right));
+    } catch (...) {
+      pool_.deallocate(place);
+      throw;
+    }
+  }
+  void destroy_node(node_t* node) {
+    node->~node_t();
+    pool_.deallocate(node);
+  }
+
   void erase_node(node_t* node) {
     left_tree_.erase(get_left(node));
     right_tree_.erase(get_right(node));
+    count_erases(1);
   }
-  void insert_node(node_t* node) {
-    left_tree_.insert(get_left(node));
-    right_tree_.insert(get_right(node));
+
+  template <typename Tree>
+  typename statistics::side side_stats(Tree const& tree,
+                                       size_t element_size) const {
+    typename statistics::side res{};
+    bimap_tree::shape shape = tree.shape();
+    res.height_ = shape.height_;
+    res.average_depth_ =
+        size_ == 0 ? 0 : static_cast<double>(shape.depth_sum_) / size_;
+    res.node_bytes_ = size_ * (sizeof(tree_node_t) + element_size);
+    res.comparisons_ = tree.instrumentation_.get(event::comparison);
+    res.lookups_ = tree.instrumentation_.get(event::lookup);
+    res.visits_ = tree.instrumentation_.get(event::visit);
+    return res;
+  }
+
+  // instrumentation hooks, empty with bimap_instrumentation::none
+  void count_inserts(size_t n) const {
+    instrumentation_.count(event::insert, n);
+  }
+  void count_erases(size_t n) const {
+    instrumentation_.count(event::erase, n);
+  }
+  void count_finds(size_t n) const {
+    instrumentation_.count(event::find, n);
+  }
+  void count_allocations(size_t n) const {
+    instrumentation_.count(event::allocation, n);
   }
 
   bool eq_left(left_t const& a, left_t const& b) const {
@@ -456,8 +1500,20 @@ private:
     }
   };
 
-  bimap_tree::tree<left_t, CompareLeft, left_getter> left_tree_;
-  bimap_tree::tree<right_t, CompareRight, right_getter> right_tree_;
+  bimap_tree::tree<left_t, CompareLeft, left_getter, Instrumentation>
+      left_tree_;
+  bimap_tree::tree<right_t, CompareRight, right_getter, Instrumentation>
+      right_tree_;
   base_node_t fake_;
   size_t size_{0};
+  pool_t pool_;
+  [[no_unique_address]] Instrumentation instrumentation_;
 };
+
+namespace pmr {
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+using bimap =
+    ::bimap<Left, Right, CompareLeft, CompareRight,
+            std::pmr::polymorphic_allocator<std::pair<Left, Right>>>;
+} // namespace pmr
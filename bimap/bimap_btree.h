@@ -0,0 +1,579 @@
+#ifndef BIMAP_BTREE_H
+#define BIMAP_BTREE_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace bimap_btree {
+
+// Uninitialised room for N objects of type T. The owner keeps track of which
+// slots are alive; all shifting functions expect a live prefix [0, size).
+template <typename T, size_t N>
+struct storage {
+  T& operator[](size_t i) noexcept {
+    return *std::launder(reinterpret_cast<T*>(data_ + i * sizeof(T)));
+  }
+  T const& operator[](size_t i) const noexcept {
+    return *std::launder(reinterpret_cast<T const*>(data_ + i * sizeof(T)));
+  }
+
+  template <typename... Args>
+  void construct(size_t i, Args&&... args) {
+    ::new (static_cast<void*>(data_ + i * sizeof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  void destroy(size_t i) noexcept {
+    (*this)[i].~T();
+  }
+
+  // opens a gap at i and moves value into it
+  void insert(size_t size, size_t i, T&& value) noexcept {
+    if (i == size) {
+      construct(i, std::move(value));
+      return;
+    }
+    construct(size, std::move((*this)[size - 1]));
+    for (size_t j = size - 1; j > i; j--) {
+      (*this)[j] = std::move((*this)[j - 1]);
+    }
+    (*this)[i] = std::move(value);
+  }
+
+  void erase(size_t size, size_t i) noexcept {
+    for (size_t j = i; j + 1 < size; j++) {
+      (*this)[j] = std::move((*this)[j + 1]);
+    }
+    destroy(size - 1);
+  }
+
+  // moves [first, last) into the free slots of to starting from dest
+  void relocate(size_t first, size_t last, storage& to, size_t dest) noexcept {
+    for (; first != last; first++, dest++) {
+      to.construct(dest, std::move((*this)[first]));
+      destroy(first);
+    }
+  }
+
+  alignas(T) std::byte data_[N * sizeof(T)];
+};
+
+// B+-tree from keys to values (pointers to the bimap's pairs). Keys are
+// copied inline into wide nodes, so a lookup costs one or two cache misses
+// per level and there are only a few levels. Leaves are doubly linked for
+// iteration. An empty tree allocates nothing.
+//
+// For every inner node the keys of children_[i] are less than keys_[i] and
+// the keys of children_[i + 1] are not less than it. Separators may be keys
+// that are no longer in the tree.
+//
+// Any insert or erase invalidates cursors. Keys must be copy constructible
+// and are expected not to throw when moved.
+template <typename K, typename V, typename Compare, typename Allocator>
+struct tree {
+  static constexpr size_t capacity =
+      std::clamp<size_t>(256 / sizeof(K), 8, 64) & ~size_t(1);
+  static constexpr size_t min_size = capacity / 2 - 1;
+
+private:
+  struct inner;
+
+  struct node_base {
+    inner* parent_{nullptr};
+    uint32_t size_{0};
+    bool leaf_;
+
+    explicit node_base(bool leaf) : leaf_(leaf) {}
+  };
+
+  struct leaf : node_base {
+    leaf() : node_base(true) {}
+
+    leaf* prev_{nullptr};
+    leaf* next_{nullptr};
+    V values_[capacity];
+    storage<K, capacity> keys_;
+  };
+
+  struct inner : node_base {
+    inner() : node_base(false) {}
+
+    node_base* children_[capacity + 1];
+    storage<K, capacity> keys_;
+  };
+
+  using leaf_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<leaf>;
+  using inner_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<inner>;
+  using leaf_traits = std::allocator_traits<leaf_allocator>;
+  using inner_traits = std::allocator_traits<inner_allocator>;
+
+public:
+  // position of an entry, leaf_ is nullptr for end
+  struct cursor {
+    leaf* leaf_{nullptr};
+    size_t pos_{0};
+
+    friend bool operator==(cursor const& a, cursor const& b) = default;
+  };
+
+  tree(Compare compare, Allocator const& alloc)
+      : leaf_alloc_(alloc), inner_alloc_(alloc), compare_(std::move(compare)) {}
+
+  tree(tree const& other) = delete;
+
+  tree(tree&& other) noexcept
+      : root_(std::exchange(other.root_, nullptr)),
+        first_(std::exchange(other.first_, nullptr)),
+        last_(std::exchange(other.last_, nullptr)),
+        leaf_alloc_(std::move(other.leaf_alloc_)),
+        inner_alloc_(std::move(other.inner_alloc_)),
+        compare_(std::move(other.compare_)) {}
+
+  tree& operator=(tree const& other) = delete;
+
+  tree& operator=(tree&& other) = delete;
+
+  ~tree() {
+    clear();
+  }
+
+  Compare const& key_comp() const {
+    return compare_;
+  }
+
+  cursor begin() const {
+    return first_ == nullptr ? end() : cursor{first_, 0};
+  }
+
+  cursor end() const {
+    return {};
+  }
+
+  cursor next(cursor c) const {
+    return normalise({c.leaf_, c.pos_ + 1});
+  }
+
+  cursor prev(cursor c) const {
+    if (c.leaf_ == nullptr) {
+      return {last_, last_->size_ - 1};
+    }
+    if (c.pos_ == 0) {
+      return {c.leaf_->prev_, c.leaf_->prev_->size_ - 1};
+    }
+    return {c.leaf_, c.pos_ - 1};
+  }
+
+  V const& value(cursor c) const {
+    return c.leaf_->values_[c.pos_];
+  }
+
+  template <typename T>
+  cursor find(T const& key) const {
+    if (root_ == nullptr) {
+      return end();
+    }
+    leaf* l = descend(key);
+    size_t pos = lower(l, key);
+    if (pos == l->size_ || compare_(key, l->keys_[pos])) {
+      return end();
+    }
+    return {l, pos};
+  }
+
+  template <typename T>
+  cursor lower_bound(T const& key) const {
+    if (root_ == nullptr) {
+      return end();
+    }
+    leaf* l = descend(key);
+    return normalise({l, lower(l, key)});
+  }
+
+  template <typename T>
+  cursor upper_bound(T const& key) const {
+    if (root_ == nullptr) {
+      return end();
+    }
+    leaf* l = descend(key);
+    return normalise({l, upper(l, key)});
+  }
+
+  // The key must not be in the tree yet. Full nodes are split on the way
+  // down, so every split has room in its parent and leaves the tree valid:
+  // an exception from an allocation or a key copy loses nothing.
+  cursor insert(K key, V value) {
+    if (root_ == nullptr) {
+      leaf* l = new_leaf();
+      root_ = first_ = last_ = l;
+    } else if (root_->size_ == capacity) {
+      inner* r = new_inner();
+      r->children_[0] = root_;
+      root_->parent_ = r;
+      try {
+        split_child(r, 0);
+      } catch (...) {
+        root_->parent_ = nullptr;
+        free_inner(r);
+        throw;
+      }
+      root_ = r;
+    }
+    node_base* node = root_;
+    while (!node->leaf_) {
+      inner* in = static_cast<inner*>(node);
+      size_t i = upper(in, key);
+      if (in->children_[i]->size_ == capacity) {
+        split_child(in, i);
+        if (!compare_(key, in->keys_[i])) {
+          i++;
+        }
+      }
+      node = in->children_[i];
+    }
+    leaf* l = static_cast<leaf*>(node);
+    size_t pos = lower(l, key);
+    l->keys_.insert(l->size_, pos, std::move(key));
+    std::copy_backward(l->values_ + pos, l->values_ + l->size_,
+                       l->values_ + l->size_ + 1);
+    l->values_[pos] = value;
+    l->size_++;
+    return {l, pos};
+  }
+
+  // returns the cursor of the entry that followed the erased one
+  cursor erase(cursor c) noexcept {
+    leaf* l = c.leaf_;
+    l->keys_.erase(l->size_, c.pos_);
+    std::copy(l->values_ + c.pos_ + 1, l->values_ + l->size_,
+              l->values_ + c.pos_);
+    l->size_--;
+    if (l == root_) {
+      if (l->size_ == 0) {
+        free_leaf(l);
+        root_ = first_ = last_ = nullptr;
+        return end();
+      }
+    } else if (l->size_ < min_size) {
+      rebalance(l, c);
+    }
+    return normalise(c);
+  }
+
+  void clear() noexcept {
+    if (root_ != nullptr) {
+      free_subtree(root_);
+      root_ = first_ = last_ = nullptr;
+    }
+  }
+
+  // allocators are swapped only if they can be, otherwise they must be equal
+  void swap(tree& other) noexcept {
+    using std::swap;
+    swap(root_, other.root_);
+    swap(first_, other.first_);
+    swap(last_, other.last_);
+    if constexpr (std::is_swappable_v<leaf_allocator>) {
+      swap(leaf_alloc_, other.leaf_alloc_);
+      swap(inner_alloc_, other.inner_alloc_);
+    }
+    swap(compare_, other.compare_);
+  }
+
+private:
+  cursor normalise(cursor c) const {
+    if (c.pos_ == c.leaf_->size_) {
+      return c.leaf_->next_ == nullptr ? end() : cursor{c.leaf_->next_, 0};
+    }
+    return c;
+  }
+
+  // the first key not less than key
+  template <typename T, typename Node>
+  size_t lower(Node const* node, T const& key) const {
+    size_t lo = 0;
+    size_t hi = node->size_;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (compare_(node->keys_[mid], key)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  // the first key greater than key
+  template <typename T, typename Node>
+  size_t upper(Node const* node, T const& key) const {
+    size_t lo = 0;
+    size_t hi = node->size_;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (compare_(key, node->keys_[mid])) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return lo;
+  }
+
+  template <typename T>
+  leaf* descend(T const& key) const {
+    node_base* node = root_;
+    while (!node->leaf_) {
+      inner* in = static_cast<inner*>(node);
+      node = in->children_[upper(in, key)];
+    }
+    return static_cast<leaf*>(node);
+  }
+
+  static size_t child_index(inner const* parent, node_base const* child) {
+    size_t i = 0;
+    while (parent->children_[i] != child) {
+      i++;
+    }
+    return i;
+  }
+
+  static void insert_child(inner* parent, size_t i, node_base* child) {
+    std::copy_backward(parent->children_ + i,
+                       parent->children_ + parent->size_ + 1,
+                       parent->children_ + parent->size_ + 2);
+    parent->children_[i] = child;
+    child->parent_ = parent;
+  }
+
+  static void erase_child(inner* parent, size_t i) {
+    std::copy(parent->children_ + i + 1,
+              parent->children_ + parent->size_ + 1, parent->children_ + i);
+  }
+
+  // splits the full i-th child of parent, which has room for one more key
+  void split_child(inner* parent, size_t i) {
+    constexpr size_t mid = capacity / 2;
+    node_base* child = parent->children_[i];
+    if (child->leaf_) {
+      leaf* l = static_cast<leaf*>(child);
+      leaf* r = new_leaf();
+      // the separator is a copy, the original stays in r
+      try {
+        parent->keys_.insert(parent->size_, i, K(l->keys_[mid]));
+      } catch (...) {
+        free_leaf(r);
+        throw;
+      }
+      l->keys_.relocate(mid, capacity, r->keys_, 0);
+      std::copy(l->values_ + mid, l->values_ + capacity, r->values_);
+      r->size_ = capacity - mid;
+      l->size_ = mid;
+      r->prev_ = l;
+      r->next_ = l->next_;
+      if (l->next_ != nullptr) {
+        l->next_->prev_ = r;
+      } else {
+        last_ = r;
+      }
+      l->next_ = r;
+      insert_child(parent, i + 1, r);
+    } else {
+      inner* l = static_cast<inner*>(child);
+      inner* r = new_inner();
+      // the middle key moves up
+      parent->keys_.insert(parent->size_, i, std::move(l->keys_[mid]));
+      l->keys_.destroy(mid);
+      l->keys_.relocate(mid + 1, capacity, r->keys_, 0);
+      for (size_t j = mid + 1; j <= capacity; j++) {
+        r->children_[j - mid - 1] = l->children_[j];
+        l->children_[j]->parent_ = r;
+      }
+      r->size_ = capacity - mid - 1;
+      l->size_ = mid;
+      insert_child(parent, i + 1, r);
+    }
+    parent->size_++;
+  }
+
+  // l has just dropped below min_size; c is the cursor of the entry after
+  // the erased one and is moved along with it
+  void rebalance(leaf* l, cursor& c) noexcept {
+    inner* parent = l->parent_;
+    size_t i = child_index(parent, l);
+    if (i > 0) {
+      leaf* left = static_cast<leaf*>(parent->children_[i - 1]);
+      if (left->size_ + l->size_ <= capacity) {
+        c = {left, left->size_ + c.pos_};
+        merge_leaves(left, l, parent, i - 1);
+        return;
+      }
+      // borrowing needs a new separator; if it can't be copied, l just
+      // stays underfull, which is still a valid tree
+      try {
+        parent->keys_[i - 1] = K(left->keys_[left->size_ - 1]);
+      } catch (...) {
+        return;
+      }
+      l->keys_.insert(l->size_, 0, std::move(left->keys_[left->size_ - 1]));
+      left->keys_.destroy(left->size_ - 1);
+      std::copy_backward(l->values_, l->values_ + l->size_,
+                         l->values_ + l->size_ + 1);
+      l->values_[0] = left->values_[left->size_ - 1];
+      left->size_--;
+      l->size_++;
+      c.pos_++;
+    } else {
+      leaf* right = static_cast<leaf*>(parent->children_[1]);
+      if (l->size_ + right->size_ <= capacity) {
+        merge_leaves(l, right, parent, 0);
+        return;
+      }
+      try {
+        parent->keys_[0] = K(right->keys_[1]);
+      } catch (...) {
+        return;
+      }
+      l->keys_.construct(l->size_, std::move(right->keys_[0]));
+      right->keys_.erase(right->size_, 0);
+      l->values_[l->size_] = right->values_[0];
+      std::copy(right->values_ + 1, right->values_ + right->size_,
+                right->values_);
+      right->size_--;
+      l->size_++;
+    }
+  }
+
+  // moves everything from r, the (k + 1)-th child of parent, into l
+  void merge_leaves(leaf* l, leaf* r, inner* parent, size_t k) noexcept {
+    r->keys_.relocate(0, r->size_, l->keys_, l->size_);
+    std::copy(r->values_, r->values_ + r->size_, l->values_ + l->size_);
+    l->size_ += r->size_;
+    r->size_ = 0;
+    l->next_ = r->next_;
+    if (r->next_ != nullptr) {
+      r->next_->prev_ = l;
+    } else {
+      last_ = l;
+    }
+    free_leaf(r);
+    parent->keys_.erase(parent->size_, k);
+    erase_child(parent, k + 1);
+    parent->size_--;
+    rebalance(parent);
+  }
+
+  void rebalance(inner* node) noexcept {
+    if (node == root_) {
+      if (node->size_ == 0) {
+        root_ = node->children_[0];
+        root_->parent_ = nullptr;
+        free_inner(node);
+      }
+      return;
+    }
+    if (node->size_ >= min_size) {
+      return;
+    }
+    inner* parent = node->parent_;
+    size_t i = child_index(parent, node);
+    if (i > 0) {
+      inner* left = static_cast<inner*>(parent->children_[i - 1]);
+      if (left->size_ + node->size_ + 1 <= capacity) {
+        merge_inners(left, node, parent, i - 1);
+        return;
+      }
+      // rotate one child from left through the parent
+      node->keys_.insert(node->size_, 0, std::move(parent->keys_[i - 1]));
+      parent->keys_[i - 1] = std::move(left->keys_[left->size_ - 1]);
+      left->keys_.destroy(left->size_ - 1);
+      insert_child(node, 0, left->children_[left->size_]);
+      left->size_--;
+      node->size_++;
+    } else {
+      inner* right = static_cast<inner*>(parent->children_[1]);
+      if (node->size_ + right->size_ + 1 <= capacity) {
+        merge_inners(node, right, parent, 0);
+        return;
+      }
+      node->keys_.construct(node->size_, std::move(parent->keys_[0]));
+      parent->keys_[0] = std::move(right->keys_[0]);
+      right->keys_.erase(right->size_, 0);
+      node->children_[node->size_ + 1] = right->children_[0];
+      right->children_[0]->parent_ = node;
+      erase_child(right, 0);
+      right->size_--;
+      node->size_++;
+    }
+  }
+
+  // moves the k-th separator of parent and everything from r into l
+  void merge_inners(inner* l, inner* r, inner* parent, size_t k) noexcept {
+    l->keys_.construct(l->size_, std::move(parent->keys_[k]));
+    r->keys_.relocate(0, r->size_, l->keys_, l->size_ + 1);
+    for (size_t j = 0; j <= r->size_; j++) {
+      l->children_[l->size_ + 1 + j] = r->children_[j];
+      r->children_[j]->parent_ = l;
+    }
+    l->size_ += r->size_ + 1;
+    r->size_ = 0;
+    free_inner(r);
+    parent->keys_.erase(parent->size_, k);
+    erase_child(parent, k + 1);
+    parent->size_--;
+    rebalance(parent);
+  }
+
+  leaf* new_leaf() {
+    leaf* res = leaf_traits::allocate(leaf_alloc_, 1);
+    return ::new (static_cast<void*>(res)) leaf();
+  }
+
+  inner* new_inner() {
+    inner* res = inner_traits::allocate(inner_alloc_, 1);
+    return ::new (static_cast<void*>(res)) inner();
+  }
+
+  void free_leaf(leaf* l) noexcept {
+    for (size_t i = 0; i < l->size_; i++) {
+      l->keys_.destroy(i);
+    }
+    l->~leaf();
+    leaf_traits::deallocate(leaf_alloc_, l, 1);
+  }
+
+  void free_inner(inner* in) noexcept {
+    for (size_t i = 0; i < in->size_; i++) {
+      in->keys_.destroy(i);
+    }
+    in->~inner();
+    inner_traits::deallocate(inner_alloc_, in, 1);
+  }
+
+  void free_subtree(node_base* node) noexcept {
+    if (node->leaf_) {
+      free_leaf(static_cast<leaf*>(node));
+      return;
+    }
+    inner* in = static_cast<inner*>(node);
+    for (size_t i = 0; i <= in->size_; i++) {
+      free_subtree(in->children_[i]);
+    }
+    free_inner(in);
+  }
+
+  node_base* root_{nullptr};
+  leaf* first_{nullptr};
+  leaf* last_{nullptr};
+  [[no_unique_address]] leaf_allocator leaf_alloc_;
+  [[no_unique_address]] inner_allocator inner_alloc_;
+  [[no_unique_address]] Compare compare_;
+};
+} // namespace bimap_btree
+
+#endif // BIMAP_BTREE_H
@@ -0,0 +1,344 @@
+#ifndef BIMAP_FLAT_H
+#define BIMAP_FLAT_H
+#include "bimap_nodes.h"
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace bimap_flat {
+
+// Positions are 32-bit to keep the right side index compact.
+using index_t = uint32_t;
+
+// Branchless binary search: the first position in [0, size) for which
+// before(i) is false, assuming before holds on a prefix. Each step only
+// moves the base with a conditional move, so the loop has a fixed trip count
+// and no mispredicted branches.
+template <typename Before>
+constexpr size_t partition_point(size_t size, Before before) {
+  if (size == 0) {
+    return 0;
+  }
+  size_t base = 0;
+  while (size > 1) {
+    size_t half = size / 2;
+    base = before(base + half) ? base + half : base;
+    size -= half;
+  }
+  return base + before(base);
+}
+
+// Pairs sorted by left as two parallel arrays, plus the permutation that
+// sorts them by right (order_) and its inverse (rank_).
+template <typename L, typename R>
+struct arrays {
+  // Same duplicates rule as the bimap range constructor: of pairs with equal
+  // lefts the first one stays, of pairs with equal rights the one with the
+  // smallest left.
+  template <typename CompareLeft, typename CompareRight>
+  static arrays build(std::vector<L> lefts, std::vector<R> rights,
+                      CompareLeft const& compare_left,
+                      CompareRight const& compare_right) {
+    if (lefts.size() > std::numeric_limits<index_t>::max()) {
+      throw std::length_error("too many pairs for a flat bimap");
+    }
+    std::vector<index_t> by_left(lefts.size());
+    std::iota(by_left.begin(), by_left.end(), 0);
+    if (!std::is_sorted(lefts.begin(), lefts.end(), compare_left)) {
+      std::stable_sort(by_left.begin(), by_left.end(),
+                       [&](index_t a, index_t b) {
+                         return compare_left(lefts[a], lefts[b]);
+                       });
+    }
+    by_left.erase(std::unique(by_left.begin(), by_left.end(),
+                              [&](index_t a, index_t b) {
+                                return !compare_left(lefts[a], lefts[b]);
+                              }),
+                  by_left.end());
+
+    // positions in by_left, sorted by right
+    std::vector<index_t> by_right(by_left.size());
+    std::iota(by_right.begin(), by_right.end(), 0);
+    auto right_of = [&](index_t k) -> R const& {
+      return rights[by_left[k]];
+    };
+    std::stable_sort(by_right.begin(), by_right.end(),
+                     [&](index_t a, index_t b) {
+                       return compare_right(right_of(a), right_of(b));
+                     });
+    by_right.erase(std::unique(by_right.begin(), by_right.end(),
+                               [&](index_t a, index_t b) {
+                                 return !compare_right(right_of(a),
+                                                       right_of(b));
+                               }),
+                   by_right.end());
+
+    // by_right now names exactly the pairs that stay
+    std::vector<bool> stays(by_left.size());
+    for (index_t k : by_right) {
+      stays[k] = true;
+    }
+    arrays res;
+    res.lefts_.reserve(by_right.size());
+    res.rights_.reserve(by_right.size());
+    std::vector<index_t> position(by_left.size());
+    for (index_t k = 0; k < by_left.size(); k++) {
+      if (stays[k]) {
+        position[k] = static_cast<index_t>(res.lefts_.size());
+        res.lefts_.push_back(std::move(lefts[by_left[k]]));
+        res.rights_.push_back(std::move(rights[by_left[k]]));
+      }
+    }
+    res.order_.resize(by_right.size());
+    res.rank_.resize(by_right.size());
+    for (index_t j = 0; j < by_right.size(); j++) {
+      res.order_[j] = position[by_right[j]];
+      res.rank_[res.order_[j]] = j;
+    }
+    return res;
+  }
+
+  std::vector<L> lefts_;
+  std::vector<R> rights_;
+  std::vector<index_t> order_;
+  std::vector<index_t> rank_;
+};
+
+// Read-only bimap over arrays laid out as above, which may live anywhere:
+// in vectors or in a mapped file. Iterators are positions in the arrays,
+// so flip() is a single load.
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight>
+struct view {
+private:
+  template <typename Tag>
+  struct iterator {
+    using value_type =
+        std::conditional_t<nodes::is_left<Tag>, Left, Right>;
+    using reference = value_type const&;
+    using pointer = value_type const*;
+    using iterator_category = std::random_access_iterator_tag;
+    using difference_type = ptrdiff_t;
+
+  private:
+    using other_tag = std::conditional_t<nodes::is_left<Tag>, nodes::right_tag,
+                                         nodes::left_tag>;
+
+    iterator(view const* owner, size_t pos) : owner_(owner), pos_(pos) {}
+
+  public:
+    iterator() = default;
+
+    value_type const& operator*() const {
+      if constexpr (nodes::is_left<Tag>) {
+        return owner_->lefts_[pos_];
+      } else {
+        return owner_->rights_[owner_->order_[pos_]];
+      }
+    }
+    value_type const* operator->() const {
+      return &operator*();
+    }
+    value_type const& operator[](difference_type n) const {
+      return *(*this + n);
+    }
+
+    iterator& operator++() {
+      pos_++;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator res = *this;
+      operator++();
+      return res;
+    }
+
+    iterator& operator--() {
+      pos_--;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator res = *this;
+      operator--();
+      return res;
+    }
+
+    iterator& operator+=(difference_type n) {
+      pos_ += n;
+      return *this;
+    }
+    iterator& operator-=(difference_type n) {
+      pos_ -= n;
+      return *this;
+    }
+    friend iterator operator+(iterator it, difference_type n) {
+      return it += n;
+    }
+    friend iterator operator+(difference_type n, iterator it) {
+      return it += n;
+    }
+    friend iterator operator-(iterator it, difference_type n) {
+      return it -= n;
+    }
+    friend difference_type operator-(iterator const& a, iterator const& b) {
+      return static_cast<difference_type>(a.pos_) -
+             static_cast<difference_type>(b.pos_);
+    }
+
+    iterator<other_tag> flip() const {
+      if (pos_ == owner_->size_) {
+        return {owner_, pos_};
+      }
+      if constexpr (nodes::is_left<Tag>) {
+        return {owner_, owner_->rank_[pos_]};
+      } else {
+        return {owner_, owner_->order_[pos_]};
+      }
+    }
+
+    friend bool operator==(iterator const& a, iterator const& b) {
+      return a.pos_ == b.pos_;
+    }
+    friend auto operator<=>(iterator const& a, iterator const& b) {
+      return a.pos_ <=> b.pos_;
+    }
+
+    friend struct view;
+
+  private:
+    view const* owner_{nullptr};
+    size_t pos_{0};
+  };
+
+public:
+  using left_iterator = iterator<nodes::left_tag>;
+  using right_iterator = iterator<nodes::right_tag>;
+
+  left_iterator find_left(Left const& key) const {
+    size_t i = lower_left(key);
+    if (i == size_ || compare_left_(key, lefts_[i])) {
+      return end_left();
+    }
+    return {this, i};
+  }
+  right_iterator find_right(Right const& key) const {
+    size_t j = lower_right(key);
+    if (j == size_ || compare_right_(key, rights_[order_[j]])) {
+      return end_right();
+    }
+    return {this, j};
+  }
+
+  // Если элемента не существует -- бросает std::out_of_range
+  Right const& at_left(Left const& key) const {
+    left_iterator it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("No such key");
+    }
+    return rights_[it.pos_];
+  }
+  Left const& at_right(Right const& key) const {
+    right_iterator it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("No such key");
+    }
+    return lefts_[order_[it.pos_]];
+  }
+
+  left_iterator lower_bound_left(Left const& key) const {
+    return {this, lower_left(key)};
+  }
+  left_iterator upper_bound_left(Left const& key) const {
+    return {this, partition_point(size_, [&](size_t i) {
+              return !compare_left_(key, lefts_[i]);
+            })};
+  }
+  right_iterator lower_bound_right(Right const& key) const {
+    return {this, lower_right(key)};
+  }
+  right_iterator upper_bound_right(Right const& key) const {
+    return {this, partition_point(size_, [&](size_t j) {
+              return !compare_right_(key, rights_[order_[j]]);
+            })};
+  }
+
+  left_iterator begin_left() const {
+    return {this, 0};
+  }
+  left_iterator end_left() const {
+    return {this, size_};
+  }
+  right_iterator begin_right() const {
+    return {this, 0};
+  }
+  right_iterator end_right() const {
+    return {this, size_};
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+  friend bool operator==(view const& a, view const& b) {
+    if (a.size_ != b.size_) {
+      return false;
+    }
+    auto equal = [](auto const& less, auto const& x, auto const& y) {
+      return !less(x, y) && !less(y, x);
+    };
+    for (size_t i = 0; i < a.size_; i++) {
+      if (!equal(a.compare_left_, a.lefts_[i], b.lefts_[i]) ||
+          !equal(a.compare_right_, a.rights_[i], b.rights_[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+protected:
+  view(CompareLeft compare_left, CompareRight compare_right)
+      : compare_left_(std::move(compare_left)),
+        compare_right_(std::move(compare_right)) {}
+
+  void reset(Left const* lefts, Right const* rights, index_t const* order,
+             index_t const* rank, size_t size) {
+    lefts_ = lefts;
+    rights_ = rights;
+    order_ = order;
+    rank_ = rank;
+    size_ = size;
+  }
+
+  size_t lower_left(Left const& key) const {
+    return partition_point(
+        size_, [&](size_t i) { return compare_left_(lefts_[i], key); });
+  }
+
+  size_t lower_right(Right const& key) const {
+    return partition_point(size_, [&](size_t j) {
+      return compare_right_(rights_[order_[j]], key);
+    });
+  }
+
+  Left const* lefts_{nullptr};
+  Right const* rights_{nullptr};
+  index_t const* order_{nullptr};
+  index_t const* rank_{nullptr};
+  size_t size_{0};
+  [[no_unique_address]] CompareLeft compare_left_;
+  [[no_unique_address]] CompareRight compare_right_;
+};
+} // namespace bimap_flat
+
+#endif // BIMAP_FLAT_H
@@ -0,0 +1,58 @@
+#ifndef BIMAP_INSTRUMENTATION_H
+#define BIMAP_INSTRUMENTATION_H
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Instrumentation policies of trees and bimaps. A policy is told about every
+// event and reports how many of each there were; a tree counts the work of
+// its lookups, a bimap counts its operations.
+namespace bimap_instrumentation {
+
+enum class event {
+  comparison,
+  lookup, // one root-to-leaf descent
+  visit,  // a node passed by a lookup
+  insert,
+  erase,
+  find,
+  allocation,
+};
+
+constexpr size_t event_count = static_cast<size_t>(event::allocation) + 1;
+
+// Counts nothing and holds nothing, the hooks compile away
+struct none {
+  void count(event, size_t = 1) const noexcept {}
+
+  size_t get(event) const noexcept {
+    return 0;
+  }
+};
+
+// Counts every event. Lookups are const and may run on several threads at
+// once, so the counters are relaxed atomics. A copy starts from zero and
+// assignment keeps the counts: they belong to the object, not to its
+// contents.
+struct counting {
+  counting() = default;
+  counting(counting const&) noexcept {}
+
+  counting& operator=(counting const&) noexcept {
+    return *this;
+  }
+
+  void count(event e, size_t n = 1) const noexcept {
+    counts_[static_cast<size_t>(e)].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  size_t get(event e) const noexcept {
+    return counts_[static_cast<size_t>(e)].load(std::memory_order_relaxed);
+  }
+
+private:
+  mutable std::array<std::atomic<size_t>, event_count> counts_{};
+};
+} // namespace bimap_instrumentation
+
+#endif // BIMAP_INSTRUMENTATION_H
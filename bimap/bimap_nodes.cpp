@@ -10,17 +10,15 @@ nodes::tree_node& nodes::tree_node::operator=(nodes::tree_node&& other) {
   construct_from_right_value(std::move(other));
   return *this;
 }
+// only fake nodes are moved: left_ is the root, right_ is not a child
 void nodes::tree_node::construct_from_right_value(nodes::tree_node&& other) {
   left_ = other.left_;
   right_ = other.right_;
-  other.reparent(this);
+  set_red(other.red());
   if (left_ != nullptr) {
-    left_->parent_ = this;
+    left_->set_parent(this);
   }
-  if (right_ != nullptr) {
-    right_->parent_ = this;
-  }
-  other.left_ = other.right_ = other.parent_ = nullptr;
+  other.left_ = other.right_ = nullptr;
 }
 nodes::tree_node* nodes::tree_node::maximum() {
   if (right_ == nullptr) {
@@ -39,10 +37,11 @@ nodes::tree_node* nodes::tree_node::next() {
     return right_->minimum();
   }
   tree_node* a = this;
-  tree_node* b = parent_;
-  while (b != nullptr && a == b->right_) {
+  tree_node* b = parent();
+  // the fake node's right_ is the maximum, not a child
+  while (b->parent() != nullptr && a == b->right_) {
     a = b;
-    b = b->parent_;
+    b = b->parent();
   }
   return b;
 }
@@ -51,23 +50,295 @@ nodes::tree_node* nodes::tree_node::prev() {
     return left_->maximum();
   }
   tree_node* a = this;
-  tree_node* b = parent_;
+  tree_node* b = parent();
   while (b != nullptr && a == b->left_) {
     a = b;
-    b = b->parent_;
+    b = b->parent();
   }
   return b;
 }
 void nodes::tree_node::reparent(nodes::tree_node* ptr) {
-  if (parent_ == nullptr) {
+  if (parent() == nullptr) {
     return;
   }
-  if (this == parent_->left_) {
-    parent_->left_ = ptr;
+  if (this == parent()->left_) {
+    parent()->left_ = ptr;
   } else {
-    parent_->right_ = ptr;
+    parent()->right_ = ptr;
   }
   if (ptr != nullptr) {
-    ptr->parent_ = parent_;
+    ptr->set_parent(parent());
+  }
+}
+bool nodes::tree_node::is_root() const {
+  return parent() != nullptr && parent()->parent() == nullptr;
+}
+nodes::tree_node* nodes::tree_node::header() {
+  tree_node* cur = this;
+  while (cur->parent() != nullptr) {
+    cur = cur->parent();
+  }
+  return cur;
+}
+#if BIMAP_ORDER_STATISTICS
+size_t nodes::tree_node::count(tree_node const* ptr) {
+  return ptr == nullptr ? 0 : static_cast<size_t>(ptr->count_);
+}
+void nodes::tree_node::update_count() {
+  count_ = count(left_) + count(right_) + 1;
+}
+void nodes::tree_node::add_to_ancestors(ptrdiff_t diff) {
+  for (tree_node* cur = parent(); cur->parent() != nullptr;
+       cur = cur->parent()) {
+    cur->count_ += diff;
+  }
+}
+size_t nodes::tree_node::rank() {
+  if (parent() == nullptr) {
+    return count(left_);
+  }
+  size_t res = count(left_);
+  for (tree_node* cur = this; !cur->is_root(); cur = cur->parent()) {
+    if (cur == cur->parent()->right_) {
+      res += count(cur->parent()->left_) + 1;
+    }
+  }
+  return res;
+}
+nodes::tree_node* nodes::tree_node::select(size_t k) {
+  tree_node* cur = left_;
+  if (k >= count(cur)) {
+    return this;
+  }
+  while (true) {
+    size_t left_count = count(cur->left_);
+    if (k == left_count) {
+      return cur;
+    }
+    if (k < left_count) {
+      cur = cur->left_;
+    } else {
+      k -= left_count + 1;
+      cur = cur->right_;
+    }
+  }
+}
+nodes::tree_node* nodes::tree_node::advance(ptrdiff_t n) {
+  if (n == 0) {
+    return this;
+  }
+  return header()->select(rank() + n);
+}
+#else
+size_t nodes::tree_node::rank() {
+  tree_node* fake = header();
+  size_t res = 0;
+  for (tree_node* cur = fake->left_ == nullptr ? fake : fake->minimum();
+       cur != this; cur = cur->next()) {
+    res++;
+  }
+  return res;
+}
+nodes::tree_node* nodes::tree_node::select(size_t k) {
+  if (left_ == nullptr) {
+    return this;
+  }
+  tree_node* cur = minimum();
+  for (; k != 0 && cur != this; k--) {
+    cur = cur->next();
+  }
+  return cur;
+}
+nodes::tree_node* nodes::tree_node::advance(ptrdiff_t n) {
+  tree_node* cur = this;
+  for (; n > 0; n--) {
+    cur = cur->next();
+  }
+  for (; n < 0; n++) {
+    cur = cur->prev();
+  }
+  return cur;
+}
+#endif
+void nodes::tree_node::rotate_left() {
+  tree_node* y = right_;
+  right_ = y->left_;
+  if (right_ != nullptr) {
+    right_->set_parent(this);
+  }
+  reparent(y);
+  y->left_ = this;
+  set_parent(y);
+#if BIMAP_ORDER_STATISTICS
+  y->count_ = count_;
+  update_count();
+#endif
+}
+void nodes::tree_node::rotate_right() {
+  tree_node* y = left_;
+  left_ = y->right_;
+  if (left_ != nullptr) {
+    left_->set_parent(this);
+  }
+  reparent(y);
+  y->right_ = this;
+  set_parent(y);
+#if BIMAP_ORDER_STATISTICS
+  y->count_ = count_;
+  update_count();
+#endif
+}
+void nodes::tree_node::rebalance_after_insert() {
+  tree_node* x = this;
+  x->set_red(true);
+#if BIMAP_ORDER_STATISTICS
+  x->count_ = 1;
+  x->add_to_ancestors(1);
+#endif
+  // the fake node is black, so the loop stops at the root
+  while (x->parent()->red()) {
+    tree_node* p = x->parent();
+    tree_node* g = p->parent();
+    if (p == g->left_) {
+      tree_node* u = g->right_;
+      if (u != nullptr && u->red()) {
+        p->set_red(false);
+        u->set_red(false);
+        g->set_red(true);
+        x = g;
+        continue;
+      }
+      if (x == p->right_) {
+        p->rotate_left();
+        std::swap(x, p);
+      }
+      p->set_red(false);
+      g->set_red(true);
+      g->rotate_right();
+    } else {
+      tree_node* u = g->left_;
+      if (u != nullptr && u->red()) {
+        p->set_red(false);
+        u->set_red(false);
+        g->set_red(true);
+        x = g;
+        continue;
+      }
+      if (x == p->left_) {
+        p->rotate_right();
+        std::swap(x, p);
+      }
+      p->set_red(false);
+      g->set_red(true);
+      g->rotate_left();
+    }
+  }
+  if (x->is_root()) {
+    x->set_red(false);
+  }
+}
+void nodes::tree_node::unlink() {
+  tree_node* x;
+  tree_node* x_parent;
+  bool removed_red = red();
+  if (left_ == nullptr || right_ == nullptr) {
+#if BIMAP_ORDER_STATISTICS
+    add_to_ancestors(-1);
+#endif
+    x = left_ == nullptr ? right_ : left_;
+    x_parent = parent();
+    reparent(x);
+  } else {
+    tree_node* y = right_->minimum();
+#if BIMAP_ORDER_STATISTICS
+    // y takes this node's place, the path from y's parent goes through it
+    y->add_to_ancestors(-1);
+    y->count_ = count_;
+#endif
+    removed_red = y->red();
+    x = y->right_;
+    if (y->parent() == this) {
+      x_parent = y;
+    } else {
+      x_parent = y->parent();
+      y->reparent(x);
+      y->right_ = right_;
+      right_->set_parent(y);
+    }
+    reparent(y);
+    y->left_ = left_;
+    left_->set_parent(y);
+    y->set_red(red());
+  }
+  if (!removed_red) {
+    rebalance_after_unlink(x, x_parent);
+  }
+  left_ = right_ = nullptr;
+  set_parent(nullptr);
+  set_red(false);
+#if BIMAP_ORDER_STATISTICS
+  count_ = 1;
+#endif
+}
+void nodes::tree_node::rebalance_after_unlink(tree_node* x,
+                                              tree_node* parent) {
+  auto is_black = [](tree_node* ptr) {
+    return ptr == nullptr || !ptr->red();
+  };
+  // x carries an extra black, parent == fake means x is the root
+  while (parent->parent() != nullptr && is_black(x)) {
+    if (x == parent->left_) {
+      tree_node* w = parent->right_;
+      if (w->red()) {
+        w->set_red(false);
+        parent->set_red(true);
+        parent->rotate_left();
+        w = parent->right_;
+      }
+      if (is_black(w->left_) && is_black(w->right_)) {
+        w->set_red(true);
+        x = parent;
+        parent = parent->parent();
+        continue;
+      }
+      if (is_black(w->right_)) {
+        w->left_->set_red(false);
+        w->set_red(true);
+        w->rotate_right();
+        w = parent->right_;
+      }
+      w->set_red(parent->red());
+      parent->set_red(false);
+      w->right_->set_red(false);
+      parent->rotate_left();
+    } else {
+      tree_node* w = parent->left_;
+      if (w->red()) {
+        w->set_red(false);
+        parent->set_red(true);
+        parent->rotate_right();
+        w = parent->left_;
+      }
+      if (is_black(w->left_) && is_black(w->right_)) {
+        w->set_red(true);
+        x = parent;
+        parent = parent->parent();
+        continue;
+      }
+      if (is_black(w->left_)) {
+        w->right_->set_red(false);
+        w->set_red(true);
+        w->rotate_left();
+        w = parent->left_;
+      }
+      w->set_red(parent->red());
+      parent->set_red(false);
+      w->left_->set_red(false);
+      parent->rotate_right();
+    }
+    return;
+  }
+  if (x != nullptr) {
+    x->set_red(false);
   }
 }
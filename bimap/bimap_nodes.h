@@ -1,6 +1,23 @@
 #ifndef BIMAP_NODES_H
 #define BIMAP_NODES_H
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Define BIMAP_ORDER_STATISTICS to 0 to drop the subtree sizes from tree
+// nodes. Ranks and positional access then take linear time.
+#ifndef BIMAP_ORDER_STATISTICS
+#define BIMAP_ORDER_STATISTICS 1
+#endif
+
+// Define BIMAP_COMPACT_NODES to 0 to keep the colour of a tree node in a
+// separate field and subtree sizes in size_t. By default the colour takes
+// the low bit of the parent link and sizes are 32-bit, which shrinks every
+// tree node by 8 bytes but limits a tree to 2^32 - 1 nodes.
+#ifndef BIMAP_COMPACT_NODES
+#define BIMAP_COMPACT_NODES 1
+#endif
+
 namespace nodes {
 
 struct left_tag;
@@ -51,6 +68,8 @@ tree_node* node_to_tree(node<L, R>* ptr) {
 
 } // namespace casts
 
+// The fake node of a tree stands for end(): its left_ is the root and its
+// right_ is the maximum (or nullptr if the tree is empty).
 struct tree_node {
   tree_node() = default;
   tree_node(tree_node&& other);
@@ -65,9 +84,76 @@ struct tree_node {
   tree_node* prev();
 
   void reparent(tree_node* ptr);
+
+  // Order statistics. rank() is the number of nodes before this one, for
+  // the fake node it is the size of the tree. select() is called on the
+  // fake node and returns it if k is out of range. advance() moves n
+  // positions, the fake node standing for end().
+  size_t rank();
+  tree_node* select(size_t k);
+  tree_node* advance(ptrdiff_t n);
+
+  // red-black balancing, the root's parent is the tree's fake node
+  void rotate_left();
+  void rotate_right();
+  void rebalance_after_insert();
+  void unlink();
+
+#if BIMAP_COMPACT_NODES
+  using count_t = uint32_t;
+
+  tree_node* parent() const {
+    return reinterpret_cast<tree_node*>(parent_red_ & ~uintptr_t(1));
+  }
+  void set_parent(tree_node* ptr) {
+    parent_red_ = reinterpret_cast<uintptr_t>(ptr) | (parent_red_ & 1);
+  }
+  bool red() const {
+    return (parent_red_ & 1) != 0;
+  }
+  void set_red(bool red) {
+    parent_red_ = (parent_red_ & ~uintptr_t(1)) | uintptr_t(red);
+  }
+#else
+  using count_t = size_t;
+
+  tree_node* parent() const {
+    return parent_;
+  }
+  void set_parent(tree_node* ptr) {
+    parent_ = ptr;
+  }
+  bool red() const {
+    return red_;
+  }
+  void set_red(bool red) {
+    red_ = red;
+  }
+#endif
+
   tree_node* left_{nullptr};
   tree_node* right_{nullptr};
+#if BIMAP_COMPACT_NODES
+  // the parent link with the colour in the low bit, nodes are aligned
+  uintptr_t parent_red_{0};
+#else
   tree_node* parent_{nullptr};
+  bool red_{false};
+#endif
+#if BIMAP_ORDER_STATISTICS
+  // number of nodes in the subtree, meaningless for the fake node
+  count_t count_{1};
+#endif
+
+private:
+  bool is_root() const;
+  tree_node* header();
+#if BIMAP_ORDER_STATISTICS
+  static size_t count(tree_node const* ptr);
+  void update_count();
+  void add_to_ancestors(ptrdiff_t diff);
+#endif
+  static void rebalance_after_unlink(tree_node* x, tree_node* parent);
 };
 
 template <typename Tag>
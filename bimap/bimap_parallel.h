@@ -0,0 +1,57 @@
+#ifndef BIMAP_PARALLEL_H
+#define BIMAP_PARALLEL_H
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace bimap_parallel {
+
+// Below this many elements per chunk starting a thread costs more than the
+// thread saves
+constexpr size_t min_chunk = 1 << 14;
+
+// Number of chunks to split work of this size into, one per thread
+inline size_t chunk_count(size_t work, size_t threads) {
+  return std::clamp<size_t>(work / min_chunk, 1, std::max<size_t>(threads, 1));
+}
+
+// Calls body(i) for every i < chunks, each on its own thread, chunk 0 on
+// the calling one. Once all are done, the first exception thrown by any of
+// them is rethrown.
+template <typename Body>
+void for_each_chunk(size_t chunks, Body const& body) {
+  std::vector<std::exception_ptr> errors(chunks);
+  auto run = [&](size_t i) {
+    try {
+      body(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(chunks - 1);
+  try {
+    for (size_t i = 1; i < chunks; i++) {
+      threads.emplace_back(run, i);
+    }
+  } catch (...) {
+    for (std::thread& t : threads) {
+      t.join();
+    }
+    throw;
+  }
+  run(0);
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  for (std::exception_ptr const& error : errors) {
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+} // namespace bimap_parallel
+
+#endif // BIMAP_PARALLEL_H
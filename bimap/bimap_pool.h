@@ -0,0 +1,321 @@
+#ifndef BIMAP_POOL_H
+#define BIMAP_POOL_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+// Define BIMAP_NODE_POOL to 0 to allocate every node with its own call to
+// the allocator.
+#ifndef BIMAP_NODE_POOL
+#define BIMAP_NODE_POOL 1
+#endif
+
+namespace bimap_pool {
+
+template <typename T>
+union slot {
+  struct slab_header {
+    slot* next_;
+    size_t size_;
+  };
+
+  slot* next_;
+  slab_header header_;
+  alignas(T) std::byte storage_[sizeof(T)];
+};
+
+template <typename T, typename Allocator>
+using slot_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<slot<T>>;
+
+// Pools that hand nodes to each other (through node handles or merge) can't
+// release their slabs on their own: a node may outlive the pool it was cut
+// from. Such pools join one group, and a dead pool leaves its slabs to the
+// group, which frees them when the last pool and the last node handle
+// referring to it are gone. Groups are joined by forwarding one to the
+// other, so a reference may point to any group on the way to the root.
+template <typename T, typename Allocator>
+struct slab_group : private slot_allocator<T, Allocator> {
+private:
+  using slot_t = slot<T>;
+  using allocator_t = slot_allocator<T, Allocator>;
+  using slot_traits = std::allocator_traits<allocator_t>;
+  using group_allocator_t =
+      typename slot_traits::template rebind_alloc<slab_group>;
+  using group_traits = std::allocator_traits<group_allocator_t>;
+
+public:
+  explicit slab_group(allocator_t const& alloc) : allocator_t(alloc) {}
+
+  static slab_group* create(allocator_t const& alloc) {
+    group_allocator_t group_alloc(alloc);
+    slab_group* res = group_traits::allocate(group_alloc, 1);
+    group_traits::construct(group_alloc, res, alloc);
+    return res;
+  }
+
+  static slab_group* retain(slab_group* group) noexcept {
+    if (group != nullptr) {
+      group->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return group;
+  }
+
+  static void release(slab_group* group) noexcept {
+    while (group != nullptr &&
+           group->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      slab_group* next = group->forward_.load(std::memory_order_acquire);
+      free_slabs(*group, group->slabs_);
+      group_allocator_t group_alloc(*group);
+      group_traits::destroy(group_alloc, group);
+      group_traits::deallocate(group_alloc, group, 1);
+      group = next;
+    }
+  }
+
+  // Makes a and b (which may already share a root) one group
+  static void join(slab_group* a, slab_group* b) {
+    while (true) {
+      a = root(a);
+      b = root(b);
+      if (a == b) {
+        return;
+      }
+      std::scoped_lock lock(a->mutex_, b->mutex_);
+      if (a->forwarded() || b->forwarded()) {
+        continue;
+      }
+      splice(a->slabs_, std::exchange(b->slabs_, nullptr));
+      retain(a);
+      b->forward_.store(a, std::memory_order_release);
+      return;
+    }
+  }
+
+  // Hands the slabs of a dying pool over to the group
+  static void leave(slab_group* group, slot_t* slabs) {
+    while (slabs != nullptr) {
+      slab_group* r = root(group);
+      std::lock_guard lock(r->mutex_);
+      if (!r->forwarded()) {
+        splice(r->slabs_, slabs);
+        slabs = nullptr;
+      }
+    }
+    release(group);
+  }
+
+  static void free_slabs(allocator_t& alloc, slot_t* slabs) noexcept {
+    while (slabs != nullptr) {
+      slot_t* next = slabs->header_.next_;
+      slot_traits::deallocate(alloc, slabs, slabs->header_.size_ + 1);
+      slabs = next;
+    }
+  }
+
+private:
+  static slab_group* root(slab_group* group) {
+    while (slab_group* next = group->forward_.load(std::memory_order_acquire)) {
+      group = next;
+    }
+    return group;
+  }
+
+  bool forwarded() const {
+    return forward_.load(std::memory_order_relaxed) != nullptr;
+  }
+
+  static void splice(slot_t*& to, slot_t* slabs) {
+    if (slabs == nullptr) {
+      return;
+    }
+    slot_t* last = slabs;
+    while (last->header_.next_ != nullptr) {
+      last = last->header_.next_;
+    }
+    last->header_.next_ = to;
+    to = slabs;
+  }
+
+  std::atomic<size_t> refs_{1};
+  std::atomic<slab_group*> forward_{nullptr};
+  std::mutex mutex_;
+  slot_t* slabs_{nullptr};
+};
+
+// Storage for objects of type T cut from contiguous slabs. Freed slots are
+// kept in a free list and reused, slabs are released only by the destructor
+// (or later, by the slab group, once the pool has shared its slots). Nothing
+// is allocated until the first call to allocate().
+template <typename T, typename Allocator>
+struct pool : private slot_allocator<T, Allocator> {
+private:
+  using slot_t = slot<T>;
+  using allocator_t = slot_allocator<T, Allocator>;
+  using traits = std::allocator_traits<allocator_t>;
+
+public:
+  using group_t = slab_group<T, Allocator>;
+
+private:
+
+  static constexpr size_t min_slab_size = 16;
+  static constexpr size_t max_slab_size = 4096;
+
+public:
+  explicit pool(Allocator const& alloc) : allocator_t(alloc) {}
+
+  pool(pool const& other) = delete;
+
+  pool(pool&& other) noexcept
+      : allocator_t(std::move(other.get_allocator())),
+        free_(std::exchange(other.free_, nullptr)),
+        cur_(std::exchange(other.cur_, nullptr)),
+        end_(std::exchange(other.end_, nullptr)),
+        slabs_(std::exchange(other.slabs_, nullptr)),
+        group_(std::exchange(other.group_, nullptr)),
+        next_slab_size_(std::exchange(other.next_slab_size_, min_slab_size)) {}
+
+  pool& operator=(pool const& other) = delete;
+
+  pool& operator=(pool&& other) = delete;
+
+  ~pool() {
+    if (group_ != nullptr) {
+      group_t::leave(group_, slabs_);
+    } else {
+      group_t::free_slabs(get_allocator(), slabs_);
+    }
+  }
+
+  allocator_t& get_allocator() noexcept {
+    return *this;
+  }
+  allocator_t const& get_allocator() const noexcept {
+    return *this;
+  }
+
+  void* allocate() {
+#if BIMAP_NODE_POOL
+    if (free_ != nullptr) {
+      slot_t* res = free_;
+      free_ = free_->next_;
+      return res;
+    }
+    if (cur_ == end_) {
+      grow();
+    }
+    return cur_++;
+#else
+    return traits::allocate(get_allocator(), 1);
+#endif
+  }
+
+  void deallocate(void* ptr) noexcept {
+#if BIMAP_NODE_POOL
+    slot_t* s = static_cast<slot_t*>(ptr);
+    s->next_ = free_;
+    free_ = s;
+#else
+    traits::deallocate(get_allocator(), static_cast<slot_t*>(ptr), 1);
+#endif
+  }
+
+  // swaps the allocators as well, the caller decides whether that is allowed;
+  // allocators that can't be swapped (polymorphic_allocator) must be equal
+  void swap(pool& other) noexcept {
+    using std::swap;
+    if constexpr (std::is_swappable_v<allocator_t>) {
+      swap(get_allocator(), other.get_allocator());
+    }
+    swap(free_, other.free_);
+    swap(cur_, other.cur_);
+    swap(end_, other.end_);
+    swap(slabs_, other.slabs_);
+    swap(group_, other.group_);
+    swap(next_slab_size_, other.next_slab_size_);
+  }
+
+  // A reference to the group of the slabs, for a slot leaving the pool
+  // inside a node handle. nullptr if slots are allocated one by one.
+  group_t* share() {
+#if BIMAP_NODE_POOL
+    if (group_ == nullptr) {
+      group_ = group_t::create(get_allocator());
+    }
+#endif
+    return group_t::retain(group_);
+  }
+
+  // Joins the group of slots that are entering this pool; the allocators
+  // of both must be equal
+  void adopt(group_t* group) {
+    if (group == nullptr || group == group_) {
+      return;
+    }
+    if (group_ == nullptr) {
+      group_ = group_t::retain(group);
+    } else {
+      group_t::join(group_, group);
+    }
+  }
+  void adopt(pool& other) {
+    group_t* group = other.share();
+    adopt(group);
+    group_t::release(group);
+  }
+
+  // Bytes held for used slots: whole slabs with their free slots, or used
+  // single slots when they are allocated one by one. Only this pool's own
+  // slabs are walked: adopted slots still live in the slabs of the pool they
+  // were cut from and are not counted here.
+  size_t memory([[maybe_unused]] size_t used) const noexcept {
+#if BIMAP_NODE_POOL
+    size_t res = 0;
+    for (slot_t* slab = slabs_; slab != nullptr; slab = slab->header_.next_) {
+      res += (slab->header_.size_ + 1) * sizeof(slot_t);
+    }
+    return res;
+#else
+    return used * sizeof(slot_t);
+#endif
+  }
+
+  // Frees a slot that has left its pool, group is what share() returned
+  static void abandon(group_t* group, Allocator const& alloc,
+                      void* ptr) noexcept {
+    if (group != nullptr) {
+      group_t::release(group);
+    } else {
+      allocator_t slot_alloc(alloc);
+      traits::deallocate(slot_alloc, static_cast<slot_t*>(ptr), 1);
+    }
+  }
+
+private:
+  // the first slot of every slab links it to the previously allocated one
+  void grow() {
+    size_t size = next_slab_size_;
+    slot_t* slab = traits::allocate(get_allocator(), size + 1);
+    slab->header_.next_ = slabs_;
+    slab->header_.size_ = size;
+    slabs_ = slab;
+    cur_ = slab + 1;
+    end_ = cur_ + size;
+    next_slab_size_ = std::min(size * 2, max_slab_size);
+  }
+
+  slot_t* free_{nullptr};
+  slot_t* cur_{nullptr};
+  slot_t* end_{nullptr};
+  slot_t* slabs_{nullptr};
+  group_t* group_{nullptr};
+  size_t next_slab_size_{min_slab_size};
+};
+} // namespace bimap_pool
+
+#endif // BIMAP_POOL_H
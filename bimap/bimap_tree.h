@@ -1,10 +1,55 @@
 #ifndef BIMAP_TREE_H
 #define BIMAP_TREE_H
+#include "bimap_instrumentation.h"
 #include "bimap_nodes.h"
+#include <algorithm>
+#include <bit>
+#include <compare>
+#include <concepts>
+#include <cstddef>
 
 namespace bimap_tree {
 
-template <typename T, typename Comparator, typename Getter>
+// Hint to start loading the cache line at ptr, a no-op where unsupported
+inline void prefetch(void const* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(ptr);
+#else
+  (void)ptr;
+#endif
+}
+
+// Comparators with is_transparent let lookups take any type they can compare
+// with the key type.
+template <typename Comparator>
+concept transparent = requires { typename Comparator::is_transparent; };
+
+// Comparators returning an ordering, like std::compare_three_way, rather than
+// bool tell less, equivalent and greater apart in one call.
+template <typename Comparator, typename A, typename B>
+concept three_way = requires(Comparator const& c, A const& a, B const& b) {
+  { c(a, b) } -> std::convertible_to<std::partial_ordering>;
+};
+
+// Place where a node with some key is to be attached. duplicate_ is the node
+// holding an equivalent key, if the lookup has noticed one.
+struct position {
+  nodes::tree_node* parent_;
+  bool to_left_;
+  nodes::tree_node* duplicate_;
+};
+
+// Number of levels of a tree and the sum of depths of its nodes, the root
+// being at depth 1
+struct shape {
+  size_t height_{0};
+  size_t depth_sum_{0};
+};
+
+// Instrumentation is told about comparisons, lookups and visited nodes, see
+// bimap_instrumentation.h
+template <typename T, typename Comparator, typename Getter,
+          typename Instrumentation = bimap_instrumentation::none>
 struct tree : Comparator {
 private:
   using tree_node_t = nodes::tree_node;
@@ -32,89 +77,323 @@ public:
     return *this;
   }
 
+  // single root-to-leaf descent, one comparison per level and one at the end
+  position find_insert_position(T const& elem) const {
+    position res{fake_, true, nullptr};
+    tree_node_t* not_greater = nullptr;
+    count_lookup();
+    for (tree_node_t* cur = fake_->left_; cur != nullptr;) {
+      count_visit();
+      res.parent_ = cur;
+      res.to_left_ = compare(elem, get_elem(cur));
+      if (res.to_left_) {
+        cur = cur->left_;
+      } else {
+        not_greater = cur;
+        cur = cur->right_;
+      }
+    }
+    if (not_greater != nullptr && !compare(get_elem(not_greater), elem)) {
+      res.duplicate_ = not_greater;
+    }
+    return res;
+  }
+
+  // Same, but first tries the places right before and right after hint
+  // (fake_ stands for end), which takes O(1) comparisons when it fits.
+  position find_insert_position(tree_node_t* hint, T const& elem) const {
+    if (hint == fake_ || compare(elem, get_elem(hint))) {
+      tree_node_t* before = hint == fake_ ? fake_->right_ : hint->prev();
+      if (before == nullptr || compare(get_elem(before), elem)) {
+        if (hint->left_ == nullptr) {
+          return {hint, true, nullptr};
+        }
+        return {before, false, nullptr};
+      }
+    } else if (compare(get_elem(hint), elem)) {
+      tree_node_t* after = hint == fake_->right_ ? fake_ : hint->next();
+      if (after == fake_ || compare(elem, get_elem(after))) {
+        if (hint->right_ == nullptr) {
+          return {hint, false, nullptr};
+        }
+        return {after, true, nullptr};
+      }
+    }
+    return find_insert_position(elem);
+  }
+
+  void insert_at(position pos, tree_node_t* ptr) {
+    ptr->set_parent(pos.parent_);
+    if (pos.to_left_) {
+      pos.parent_->left_ = ptr;
+    } else {
+      pos.parent_->right_ = ptr;
+    }
+    if (pos.parent_ == fake_ ||
+        (pos.parent_ == fake_->right_ && !pos.to_left_)) {
+      fake_->right_ = ptr;
+    }
+    ptr->rebalance_after_insert();
+  }
+
   void insert(tree_node_t* ptr) {
-    tree_node_t* cur = fake_;
-    while (cur != nullptr) {
-      if (cur->parent_ == nullptr || compare(ptr, cur)) {
-        if (cur->left_ != nullptr) {
-          cur = cur->left_;
-        } else {
-          ptr->parent_ = cur;
-          cur->left_ = ptr;
-          break;
+    insert_at(find_insert_position(get_elem(ptr)), ptr);
+  }
+
+  // Place right before next (fake_ stands for end) in the order of the tree.
+  // Takes no comparisons, so it stays right while nodes other than next are
+  // erased.
+  position position_before(tree_node_t* next) const {
+    if (next == fake_) {
+      if (fake_->right_ == nullptr) {
+        return {fake_, true, nullptr};
+      }
+      return {fake_->right_, false, nullptr};
+    }
+    if (next->left_ == nullptr) {
+      return {next, true, nullptr};
+    }
+    return {next->left_->maximum(), false, nullptr};
+  }
+
+  void erase(tree_node_t* ptr) {
+    if (ptr == fake_->right_) {
+      fake_->right_ = ptr->prev();
+    }
+    ptr->unlink();
+  }
+
+  // Links proj(first[0]), ..., proj(first[size - 1]), which must be sorted
+  // and hold distinct keys, into this empty tree in O(size). The result is
+  // perfectly balanced, only the nodes of an incomplete last level are red.
+  template <typename It, typename Proj>
+  void build(It first, size_t size, Proj proj) {
+    if (size == 0) {
+      return;
+    }
+    size_t red_depth = std::bit_width(size) - 1;
+    fake_->left_ = build_subtree(first, size, proj, fake_, 0, red_depth);
+    fake_->right_ = proj(first[size - 1]);
+  }
+
+  // Looks up keys[0], ..., keys[count - 1] and calls found(i, node) with the
+  // node equal to keys[i] or with fake_. Up to batch_width descents take
+  // turns level by level, each step prefetching the node it moves to, so
+  // the cache misses of different keys overlap instead of queuing up.
+  template <typename K, typename Found>
+  void find_batch(K const* keys, size_t count, Found found) const {
+    constexpr size_t batch_width = 16;
+    tree_node_t* cur[batch_width];
+    tree_node_t* not_less[batch_width];
+    for (size_t base = 0; base < count; base += batch_width) {
+      size_t width = std::min(batch_width, count - base);
+      for (size_t i = 0; i < width; i++) {
+        cur[i] = fake_->left_;
+        not_less[i] = fake_;
+        count_lookup();
+      }
+      for (size_t active = width; active != 0;) {
+        active = 0;
+        for (size_t i = 0; i < width; i++) {
+          tree_node_t* node = cur[i];
+          if (node == nullptr) {
+            continue;
+          }
+          count_visit();
+          // selects rather than branches, the outcome is a coin toss
+          bool less = compare(get_elem(node), keys[base + i]);
+          not_less[i] = less ? not_less[i] : node;
+          node = less ? node->right_ : node->left_;
+          cur[i] = node;
+          if (node != nullptr) {
+            prefetch(node);
+            prefetch(&get_elem(node));
+            active++;
+          }
         }
+      }
+      for (size_t i = 0; i < width; i++) {
+        tree_node_t* node = not_less[i];
+        if (node != fake_ && compare(keys[base + i], get_elem(node))) {
+          node = fake_;
+        }
+        found(base + i, node);
+      }
+    }
+  }
+
+  // Whether node may hold key instead of its element and keep its place
+  template <typename K>
+  bool fits(tree_node_t* node, K const& key) const {
+    tree_node_t* before = node->prev();
+    tree_node_t* after = node == fake_->right_ ? fake_ : node->next();
+    return (before == nullptr || compare(get_elem(before), key)) &&
+           (after == fake_ || compare(key, get_elem(after)));
+  }
+
+  // Empties the tree in O(size) without any rebalancing. dispose is called
+  // on every node after its children, once nothing links to it any more, so
+  // it may free the node.
+  template <typename Dispose>
+  void clear(Dispose dispose) {
+    tree_node_t* cur = fake_->left_;
+    while (cur != nullptr) {
+      if (cur->left_ != nullptr) {
+        cur = cur->left_;
+      } else if (cur->right_ != nullptr) {
+        cur = cur->right_;
       } else {
-        if (cur->right_ != nullptr) {
-          cur = cur->right_;
+        tree_node_t* parent = cur->parent();
+        if (parent->left_ == cur) {
+          parent->left_ = nullptr;
         } else {
-          ptr->parent_ = cur;
-          cur->right_ = ptr;
-          break;
+          parent->right_ = nullptr;
         }
+        dispose(cur);
+        cur = parent == fake_ ? nullptr : parent;
       }
     }
+    fake_->right_ = nullptr;
   }
 
-  void erase(tree_node_t* ptr) {
-    tree_node_t* ret = ptr->next();
-    if (ptr->left_ == nullptr && ptr->right_ == nullptr) {
-      ptr->reparent(nullptr);
-    } else if (ptr->left_ == nullptr) {
-      ptr->reparent(ptr->right_);
-    } else if (ptr->right_ == nullptr) {
-      ptr->reparent(ptr->left_);
-    } else {
-      erase(ret);
-      ptr->reparent(ret);
-      if (ptr->left_ != nullptr) {
-        ptr->left_->parent_ = ret;
-        ret->left_ = ptr->left_;
+  // Node equivalent to key or fake_. A three-way comparator is called once
+  // per level and stops at the first match, otherwise this is lower_bound
+  // and one more comparison.
+  template <typename K>
+  tree_node_t* find(K const& key) const {
+    if constexpr (three_way<Comparator, K, T>) {
+      count_lookup();
+      for (tree_node_t* cur = fake_->left_; cur != nullptr;) {
+        count_visit();
+        count_comparison();
+        auto order = Comparator::operator()(key, get_elem(cur));
+        if (order < 0) {
+          cur = cur->left_;
+        } else if (order > 0) {
+          cur = cur->right_;
+        } else {
+          return cur;
+        }
       }
-      if (ptr->right_ != nullptr) {
-        ptr->right_->parent_ = ret;
-        ret->right_ = ptr->right_;
+      return fake_;
+    } else {
+      tree_node_t* res = lower_bound(key);
+      if (res != fake_ && compare(key, get_elem(res))) {
+        return fake_;
       }
+      return res;
     }
-    ptr->left_ = ptr->right_ = ptr->parent_ = nullptr;
   }
 
-  tree_node_t* find(T const& elem) const {
-    tree_node_t* cur = fake_;
-    if (cur->left_ == nullptr) {
-      return cur;
-    }
-    cur = cur->left_;
-    while (true) {
-      if (are_equal(get_elem(cur), elem)) {
-        return cur;
+  // First node not less than key or fake_, one comparison per level
+  template <typename K>
+  tree_node_t* lower_bound(K const& key) const {
+    tree_node_t* res = fake_;
+    count_lookup();
+    for (tree_node_t* cur = fake_->left_; cur != nullptr;) {
+      count_visit();
+      if (compare(get_elem(cur), key)) {
+        cur = cur->right_;
+      } else {
+        res = cur;
+        cur = cur->left_;
       }
-      if (cur->left_ != nullptr && compare(elem, get_elem(cur))) {
+    }
+    return res;
+  }
+
+  // First node greater than key or fake_, one comparison per level
+  template <typename K>
+  tree_node_t* upper_bound(K const& key) const {
+    tree_node_t* res = fake_;
+    count_lookup();
+    for (tree_node_t* cur = fake_->left_; cur != nullptr;) {
+      count_visit();
+      if (compare(key, get_elem(cur))) {
+        res = cur;
         cur = cur->left_;
-      } else if (cur->right_ != nullptr && !compare(elem, get_elem(cur))) {
-        cur = cur->right_;
       } else {
-        return cur;
+        cur = cur->right_;
       }
     }
+    return res;
+  }
+
+  // O(size), the recursion goes as deep as the tree is high
+  bimap_tree::shape shape() const {
+    bimap_tree::shape res;
+    measure(fake_->left_, 1, res);
+    return res;
   }
 
   static T const& get_elem(tree_node_t* a) {
     return Getter::get(a);
   }
 
-  bool compare(T const& a, T const& b) const {
-    return Comparator::operator()(a, b);
+  template <typename A, typename B>
+  bool compare(A const& a, B const& b) const {
+    count_comparison();
+    if constexpr (three_way<Comparator, A, B>) {
+      return Comparator::operator()(a, b) < 0;
+    } else {
+      return Comparator::operator()(a, b);
+    }
+  }
+
+  template <typename A, typename B>
+  bool are_equal(A const& a, B const& b) const {
+    if constexpr (three_way<Comparator, A, B>) {
+      count_comparison();
+      return Comparator::operator()(a, b) == 0;
+    } else {
+      return !compare(a, b) && !compare(b, a);
+    }
   }
 
-  bool are_equal(T const& a, T const& b) const {
-    return !compare(a, b) && !compare(b, a);
+  tree_node_t* fake_{nullptr};
+  [[no_unique_address]] Instrumentation instrumentation_;
+
+private:
+  void count_comparison() const {
+    instrumentation_.count(bimap_instrumentation::event::comparison);
+  }
+  void count_lookup() const {
+    instrumentation_.count(bimap_instrumentation::event::lookup);
+  }
+  void count_visit() const {
+    instrumentation_.count(bimap_instrumentation::event::visit);
   }
 
-  bool compare(nodes::tree_node* a, nodes::tree_node* b) {
-    return compare(get_elem(a), get_elem(b));
+  static void measure(tree_node_t* node, size_t depth,
+                      bimap_tree::shape& res) {
+    if (node == nullptr) {
+      return;
+    }
+    res.height_ = std::max(res.height_, depth);
+    res.depth_sum_ += depth;
+    measure(node->left_, depth + 1, res);
+    measure(node->right_, depth + 1, res);
   }
 
-  tree_node_t* fake_{nullptr};
+  template <typename It, typename Proj>
+  static tree_node_t* build_subtree(It first, size_t size, Proj& proj,
+                                    tree_node_t* parent, size_t depth,
+                                    size_t red_depth) {
+    if (size == 0) {
+      return nullptr;
+    }
+    size_t mid = size / 2;
+    tree_node_t* root = proj(first[mid]);
+    root->set_parent(parent);
+    root->set_red(depth != 0 && depth == red_depth);
+#if BIMAP_ORDER_STATISTICS
+    root->count_ = size;
+#endif
+    root->left_ = build_subtree(first, mid, proj, root, depth + 1, red_depth);
+    root->right_ = build_subtree(first + mid + 1, size - mid - 1, proj, root,
+                                 depth + 1, red_depth);
+    return root;
+  }
 };
 } // namespace bimap_tree
 
@@ -0,0 +1,521 @@
+#pragma once
+
+#include "bimap_btree.h"
+#include "bimap_nodes.h"
+#include "bimap_pool.h"
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// bimap, в котором каждая сторона -- B+-дерево с ключами внутри широких
+// узлов, а листья указывают на общие узлы пар. Поиск касается нескольких
+// кэш-линий на уровень при высоте в несколько уровней. Ключи хранятся
+// дважды (в паре и в дереве), поэтому должны копироваться.
+// В отличие от bimap, любая вставка или удаление инвалидирует итераторы;
+// ссылки на элементы остаются валидными. flip() ищет пару в другом дереве
+// за O(log n).
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct btree_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+
+  using alloc_traits = std::allocator_traits<Allocator>;
+
+  struct node_t {
+    template <typename A, typename B>
+    node_t(A&& left, B&& right)
+        : l_element(std::forward<A>(left)), r_element(std::forward<B>(right)) {
+    }
+
+    left_t l_element;
+    right_t r_element;
+  };
+
+  using left_tree_t =
+      bimap_btree::tree<left_t, node_t*, CompareLeft, Allocator>;
+  using right_tree_t =
+      bimap_btree::tree<right_t, node_t*, CompareRight, Allocator>;
+
+  template <typename Tag>
+  using tree_t =
+      std::conditional_t<nodes::is_left<Tag>, left_tree_t, right_tree_t>;
+
+  template <typename Tag>
+  static auto& element(node_t* node) {
+    if constexpr (nodes::is_left<Tag>) {
+      return node->l_element;
+    } else {
+      return node->r_element;
+    }
+  }
+
+  template <typename Tag>
+  struct iterator {
+    using value_type = std::conditional_t<nodes::is_left<Tag>, left_t, right_t>;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = ptrdiff_t;
+
+  private:
+    using other_tag = std::conditional_t<nodes::is_left<Tag>, nodes::right_tag,
+                                         nodes::left_tag>;
+    using cursor = typename tree_t<Tag>::cursor;
+
+    iterator(btree_bimap const* map, cursor pos) : map_(map), pos_(pos) {}
+
+  public:
+    iterator() = default;
+
+    value_type const& operator*() const {
+      return element<Tag>(node());
+    }
+    value_type const* operator->() const {
+      return &operator*();
+    }
+
+    iterator& operator++() {
+      pos_ = map_->tree_of<Tag>().next(pos_);
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator res = *this;
+      operator++();
+      return res;
+    }
+
+    iterator& operator--() {
+      pos_ = map_->tree_of<Tag>().prev(pos_);
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator res = *this;
+      operator--();
+      return res;
+    }
+
+    iterator<other_tag> flip() const {
+      auto const& other = map_->tree_of<other_tag>();
+      if (pos_.leaf_ == nullptr) {
+        return {map_, other.end()};
+      }
+      return {map_, other.find(element<other_tag>(node()))};
+    }
+
+    friend bool operator==(iterator const& a, iterator const& b) {
+      return a.pos_ == b.pos_;
+    }
+
+    friend bool operator!=(iterator const& a, iterator const& b) {
+      return !(a == b);
+    }
+
+    friend struct btree_bimap;
+
+  private:
+    node_t* node() const {
+      return map_->tree_of<Tag>().value(pos_);
+    }
+
+    btree_bimap const* map_{nullptr};
+    cursor pos_;
+  };
+
+public:
+  using left_iterator = iterator<nodes::left_tag>;
+  using right_iterator = iterator<nodes::right_tag>;
+
+  using allocator_type = Allocator;
+
+  // Создает btree_bimap не содержащий ни одной пары. Пустой btree_bimap не
+  // делает динамических аллокаций.
+  explicit btree_bimap(CompareLeft compare_left = CompareLeft(),
+                       CompareRight compare_right = CompareRight(),
+                       Allocator const& alloc = Allocator())
+      : left_tree_(std::move(compare_left), alloc),
+        right_tree_(std::move(compare_right), alloc), pool_(alloc) {}
+
+  explicit btree_bimap(Allocator const& alloc)
+      : btree_bimap(CompareLeft(), CompareRight(), alloc) {}
+
+  btree_bimap(btree_bimap const& other)
+      : btree_bimap(other, alloc_traits::select_on_container_copy_construction(
+                               other.get_allocator())) {}
+
+  btree_bimap(btree_bimap const& other, Allocator const& alloc)
+      : btree_bimap(other.left_tree_.key_comp(), other.right_tree_.key_comp(),
+                    alloc) {
+    for (left_iterator it = other.begin_left(); it != other.end_left(); it++) {
+      node_t* from = it.node();
+      link_node(create_node(from->l_element, from->r_element));
+    }
+  }
+
+  btree_bimap(btree_bimap&& other) noexcept
+      : left_tree_(std::move(other.left_tree_)),
+        right_tree_(std::move(other.right_tree_)),
+        size_(std::exchange(other.size_, 0)), pool_(std::move(other.pool_)) {}
+
+  btree_bimap& operator=(btree_bimap const& other) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (alloc_traits::propagate_on_container_copy_assignment::value) {
+      btree_bimap(other, other.get_allocator()).swap_contents(*this);
+    } else {
+      btree_bimap(other, get_allocator()).swap_contents(*this);
+    }
+    return *this;
+  }
+  btree_bimap& operator=(btree_bimap&& other) noexcept(
+      alloc_traits::propagate_on_container_move_assignment::value ||
+      alloc_traits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (alloc_traits::propagate_on_container_move_assignment::value ||
+                  alloc_traits::is_always_equal::value) {
+      swap_contents(other);
+    } else if (get_allocator() == other.get_allocator()) {
+      swap_contents(other);
+    } else {
+      btree_bimap tmp(left_tree_.key_comp(), right_tree_.key_comp(),
+                      get_allocator());
+      for (left_iterator it = other.begin_left(); it != other.end_left();
+           it++) {
+        node_t* from = it.node();
+        tmp.link_node(tmp.create_node(std::move(from->l_element),
+                                      std::move(from->r_element)));
+      }
+      other.clear();
+      tmp.swap_contents(*this);
+    }
+    return *this;
+  }
+
+  void swap(btree_bimap& other) {
+    assert(alloc_traits::propagate_on_container_swap::value ||
+           get_allocator() == other.get_allocator());
+    swap_contents(other);
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(pool_.get_allocator());
+  }
+
+  ~btree_bimap() {
+    clear();
+  }
+
+  // Вставка пары (left, right), возвращает итератор на left.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится и возвращается end_left().
+  left_iterator insert(left_t const& left, right_t const& right) {
+    return insert_impl(left, right);
+  }
+  left_iterator insert(left_t const& left, right_t&& right) {
+    return insert_impl(left, std::move(right));
+  }
+  left_iterator insert(left_t&& left, right_t const& right) {
+    return insert_impl(std::move(left), right);
+  }
+  left_iterator insert(left_t&& left, right_t&& right) {
+    return insert_impl(std::move(left), std::move(right));
+  }
+
+  // Удаляет пару, возвращает итератор на следующий элемент.
+  left_iterator erase_left(left_iterator it) {
+    return erase_impl(it);
+  }
+  right_iterator erase_right(right_iterator it) {
+    return erase_impl(it);
+  }
+
+  // Удаляет пару по ключу, возвращает была ли пара удалена
+  bool erase_left(left_t const& left) {
+    return erase_key_impl<nodes::left_tag>(left);
+  }
+  bool erase_right(right_t const& right) {
+    return erase_key_impl<nodes::right_tag>(right);
+  }
+
+  // Удаляет [first, last). Удаление сдвигает элементы внутри листьев,
+  // поэтому конец диапазона запоминается по паре, а не по итератору.
+  left_iterator erase_left(left_iterator first, left_iterator last) {
+    return erase_range_impl(first, last);
+  }
+  right_iterator erase_right(right_iterator first, right_iterator last) {
+    return erase_range_impl(first, last);
+  }
+
+  void clear() {
+    for (left_iterator it = begin_left(); it != end_left(); it++) {
+      destroy_node(it.node());
+    }
+    left_tree_.clear();
+    right_tree_.clear();
+    size_ = 0;
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(left_t const& left) const {
+    return {this, left_tree_.find(left)};
+  }
+  right_iterator find_right(right_t const& right) const {
+    return {this, right_tree_.find(right)};
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const& at_left(left_t const& key) const {
+    return at_impl<nodes::left_tag>(key);
+  }
+  left_t const& at_right(right_t const& key) const {
+    return at_impl<nodes::right_tag>(key);
+  }
+
+  // Как у bimap: если ключа нет, вставляет пару с дефолтным элементом на
+  // противоположной стороне; если дефолтный элемент уже занят, его пара
+  // получает запрашиваемый ключ.
+  template <typename R = right_t,
+            typename std::enable_if_t<std::is_default_constructible_v<R>,
+                                      bool> = true>
+  right_t const& at_left_or_default(left_t const& key) {
+    left_iterator it_l = find_left(key);
+    if (it_l != end_left()) {
+      return *(it_l.flip());
+    }
+    right_t tmp = right_t();
+    right_iterator it_r = find_right(tmp);
+    if (it_r == end_right()) {
+      return *(insert(key, std::move(tmp)).flip());
+    }
+    node_t* node = it_r.node();
+    rekey<nodes::left_tag>(node, key);
+    return node->r_element;
+  }
+
+  template <typename L = left_t,
+            typename std::enable_if_t<std::is_default_constructible_v<L>,
+                                      bool> = true>
+  left_t const& at_right_or_default(right_t const& key) {
+    right_iterator it_r = find_right(key);
+    if (it_r != end_right()) {
+      return *(it_r.flip());
+    }
+    left_t tmp = left_t();
+    left_iterator it_l = find_left(tmp);
+    if (it_l == end_left()) {
+      return *insert(std::move(tmp), key);
+    }
+    node_t* node = it_l.node();
+    rekey<nodes::right_tag>(node, key);
+    return node->l_element;
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(left_t const& left) const {
+    return {this, left_tree_.lower_bound(left)};
+  }
+  left_iterator upper_bound_left(left_t const& left) const {
+    return {this, left_tree_.upper_bound(left)};
+  }
+  right_iterator lower_bound_right(right_t const& right) const {
+    return {this, right_tree_.lower_bound(right)};
+  }
+  right_iterator upper_bound_right(right_t const& right) const {
+    return {this, right_tree_.upper_bound(right)};
+  }
+
+  left_iterator begin_left() const {
+    return {this, left_tree_.begin()};
+  }
+  left_iterator end_left() const {
+    return {this, left_tree_.end()};
+  }
+  right_iterator begin_right() const {
+    return {this, right_tree_.begin()};
+  }
+  right_iterator end_right() const {
+    return {this, right_tree_.end()};
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+  friend bool operator==(btree_bimap const& a, btree_bimap const& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    auto const& less_left = a.left_tree_.key_comp();
+    auto const& less_right = a.right_tree_.key_comp();
+    for (left_iterator it1 = a.begin_left(), it2 = b.begin_left();
+         it1 != a.end_left(); it1++, it2++) {
+      node_t* x = node_of(it1);
+      node_t* y = node_of(it2);
+      if (less_left(x->l_element, y->l_element) ||
+          less_left(y->l_element, x->l_element) ||
+          less_right(x->r_element, y->r_element) ||
+          less_right(y->r_element, x->r_element)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  friend bool operator!=(btree_bimap const& a, btree_bimap const& b) {
+    return !(a == b);
+  }
+
+private:
+  template <typename Tag>
+  static node_t* node_of(iterator<Tag> it) {
+    return it.node();
+  }
+
+  template <typename Tag>
+  auto const& tree_of() const {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_tree_;
+    } else {
+      return right_tree_;
+    }
+  }
+
+  template <typename Tag>
+  auto& tree_of() {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_tree_;
+    } else {
+      return right_tree_;
+    }
+  }
+
+  template <typename Tag, typename K>
+  auto const& at_impl(K const& key) const {
+    auto const& tree = tree_of<Tag>();
+    auto pos = tree.find(key);
+    if (pos == tree.end()) {
+      throw std::out_of_range("No such key");
+    }
+    using other_tag = typename iterator<Tag>::other_tag;
+    return element<other_tag>(tree.value(pos));
+  }
+
+  template <typename Tag, typename K>
+  bool erase_key_impl(K const& key) {
+    auto pos = tree_of<Tag>().find(key);
+    if (pos == tree_of<Tag>().end()) {
+      return false;
+    }
+    erase_impl(iterator<Tag>(this, pos));
+    return true;
+  }
+
+  template <typename Tag>
+  iterator<Tag> erase_impl(iterator<Tag> it) {
+    using other_tag = typename iterator<Tag>::other_tag;
+    node_t* node = it.node();
+    auto& other = tree_of<other_tag>();
+    other.erase(other.find(element<other_tag>(node)));
+    auto next = tree_of<Tag>().erase(it.pos_);
+    destroy_node(node);
+    size_--;
+    return {this, next};
+  }
+
+  template <typename Tag>
+  iterator<Tag> erase_range_impl(iterator<Tag> first, iterator<Tag> last) {
+    if (last == iterator<Tag>(this, tree_of<Tag>().end())) {
+      while (first != last) {
+        first = erase_impl(first);
+      }
+      return first;
+    }
+    node_t* stop = last.node();
+    while (first.node() != stop) {
+      first = erase_impl(first);
+    }
+    return first;
+  }
+
+  template <typename A, typename B>
+  left_iterator insert_impl(A&& left, B&& right) {
+    if (left_tree_.find(left) != left_tree_.end() ||
+        right_tree_.find(right) != right_tree_.end()) {
+      return end_left();
+    }
+    return {this,
+            link_node(create_node(std::forward<A>(left),
+                                  std::forward<B>(right)))};
+  }
+
+  // adds a new pair to both trees, destroys it if that fails
+  typename left_tree_t::cursor link_node(node_t* node) {
+    typename left_tree_t::cursor pos;
+    try {
+      pos = left_tree_.insert(node->l_element, node);
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    try {
+      right_tree_.insert(node->r_element, node);
+    } catch (...) {
+      left_tree_.erase(pos);
+      destroy_node(node);
+      throw;
+    }
+    size_++;
+    return pos;
+  }
+
+  // Gives the pair a new key on the Tag side. The new key is inserted into
+  // the tree before the old one is erased, so nothing is lost on exception.
+  template <typename Tag, typename K>
+  void rekey(node_t* node, K const& key) {
+    auto& tree = tree_of<Tag>();
+    std::remove_cvref_t<decltype(element<Tag>(node))> copy(key);
+    tree.insert(key, node);
+    tree.erase(tree.find(element<Tag>(node)));
+    element<Tag>(node) = std::move(copy);
+  }
+
+  template <typename A, typename B>
+  node_t* create_node(A&& left, B&& right) {
+    void* place = pool_.allocate();
+    try {
+      return new (place) node_t(std::forward<A>(left), std::forward<B>(right));
+    } catch (...) {
+      pool_.deallocate(place);
+      throw;
+    }
+  }
+  void destroy_node(node_t* node) {
+    node->~node_t();
+    pool_.deallocate(node);
+  }
+
+  void swap_contents(btree_bimap& other) {
+    left_tree_.swap(other.left_tree_);
+    right_tree_.swap(other.right_tree_);
+    std::swap(size_, other.size_);
+    pool_.swap(other.pool_);
+  }
+
+  left_tree_t left_tree_;
+  right_tree_t right_tree_;
+  size_t size_{0};
+  bimap_pool::pool<node_t, Allocator> pool_;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "bimap.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace bimap_concurrent {
+
+// Number of readers inside one version, split over cache lines so that
+// readers on different cores don't fight over one counter.
+struct read_indicator {
+  static constexpr size_t stripes = 64;
+
+  static size_t stripe() {
+    thread_local size_t res =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % stripes;
+    return res;
+  }
+
+  void arrive(size_t s) {
+    counters_[s].value_.fetch_add(1);
+  }
+
+  void depart(size_t s) {
+    counters_[s].value_.fetch_sub(1);
+  }
+
+  bool empty() const {
+    for (auto const& c : counters_) {
+      if (c.value_.load() != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  struct alignas(64) counter {
+    std::atomic<ptrdiff_t> value_{0};
+  };
+
+  std::array<counter, stripes> counters_;
+};
+} // namespace bimap_concurrent
+
+// bimap для многих читателей и писателей, где читатели не берут блокировок
+// (схема Left-Right). Хранятся две копии bimap: читатели работают с одной,
+// пока писатель меняет другую, затем копии меняются ролями, и после ухода
+// старых читателей изменение повторяется на второй копии.
+//
+// Чтение идет через snapshot: пока он жив, содержимое не меняется, его
+// можно искать и обходить. Писатели упорядочены мьютексом и ждут, пока
+// читатели покинут копию, которую им нужно изменить, поэтому snapshot не
+// стоит держать долго. Памяти нужно вдвое больше, чем одному bimap.
+// Instrumentation с bimap_instrumentation::counting считает и поиски
+// читателей: ее счетчики атомарны.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Instrumentation = bimap_instrumentation::none>
+struct concurrent_bimap {
+  using bimap_t =
+      bimap<Left, Right, CompareLeft, CompareRight, Allocator, Instrumentation>;
+
+  // Согласованное состояние для чтения, держит копию от изменений
+  struct snapshot {
+    snapshot(snapshot const& other) = delete;
+    snapshot& operator=(snapshot const& other) = delete;
+
+    ~snapshot() {
+      owner_->indicators_[version_].depart(stripe_);
+    }
+
+    bimap_t const& operator*() const {
+      return *map_;
+    }
+    bimap_t const* operator->() const {
+      return map_;
+    }
+
+  private:
+    explicit snapshot(concurrent_bimap const* owner)
+        : owner_(owner), version_(owner->version_.load()),
+          stripe_(bimap_concurrent::read_indicator::stripe()) {
+      owner_->indicators_[version_].arrive(stripe_);
+      map_ = &owner_->maps_[owner_->reading_.load()];
+    }
+
+    friend struct concurrent_bimap;
+
+    concurrent_bimap const* owner_;
+    size_t version_;
+    size_t stripe_;
+    bimap_t const* map_;
+  };
+
+  explicit concurrent_bimap(CompareLeft compare_left = CompareLeft(),
+                            CompareRight compare_right = CompareRight(),
+                            Allocator const& alloc = Allocator())
+      : maps_{bimap_t(compare_left, compare_right, alloc),
+              bimap_t(compare_left, compare_right, alloc)} {}
+
+  concurrent_bimap(concurrent_bimap const& other) = delete;
+  concurrent_bimap& operator=(concurrent_bimap const& other) = delete;
+
+  snapshot read() const {
+    return snapshot(this);
+  }
+
+  // Поиск без удержания snapshot, возвращают копии элементов
+  std::optional<Right> find_left(Left const& key) const {
+    snapshot s = read();
+    auto it = s->find_left(key);
+    if (it == s->end_left()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+  std::optional<Left> find_right(Right const& key) const {
+    snapshot s = read();
+    auto it = s->find_right(key);
+    if (it == s->end_right()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+
+  // Изменения, возвращают то же, что и соответствующие методы bimap.
+  // Элементы копируются в обе копии bimap.
+  bool insert(Left const& left, Right const& right) {
+    return modify(
+        [&](bimap_t& b) { return b.insert(left, right) != b.end_left(); });
+  }
+  bool erase_left(Left const& left) {
+    return modify([&](bimap_t& b) { return b.erase_left(left); });
+  }
+  bool erase_right(Right const& right) {
+    return modify([&](bimap_t& b) { return b.erase_right(right); });
+  }
+  void clear() {
+    modify([](bimap_t& b) { b.clear(); });
+  }
+
+  // Применяет op к обеим копиям по очереди и возвращает результат первого
+  // вызова. op должен одинаково менять одинаковые bimap. Если первый вызов
+  // бросает исключение, ничего не меняется; если второй -- вторая копия
+  // заменяется копией первой.
+  template <typename Op>
+  auto modify(Op op) {
+    std::lock_guard<std::mutex> lock(writer_);
+    size_t reading = reading_.load();
+    if constexpr (std::is_void_v<decltype(op(maps_[0]))>) {
+      op(maps_[1 - reading]);
+      publish(reading);
+      repeat(op, reading);
+    } else {
+      auto res = op(maps_[1 - reading]);
+      publish(reading);
+      repeat(op, reading);
+      return res;
+    }
+  }
+
+private:
+  template <typename Op>
+  void repeat(Op& op, size_t target) {
+    try {
+      op(maps_[target]);
+    } catch (...) {
+      resync(target);
+    }
+  }
+
+  // the copies must never differ, so failing to copy is fatal
+  void resync(size_t target) noexcept {
+    maps_[target] = maps_[1 - target];
+  }
+
+  // sends new readers to the updated copy and waits until nobody reads the
+  // old one; flipping the version in between makes sure readers that came
+  // in before the switch but read reading_ late are waited for too
+  void publish(size_t reading) {
+    reading_.store(1 - reading);
+    size_t version = version_.load();
+    wait_for_readers(1 - version);
+    version_.store(1 - version);
+    wait_for_readers(version);
+  }
+
+  void wait_for_readers(size_t version) const {
+    while (!indicators_[version].empty()) {
+      std::this_thread::yield();
+    }
+  }
+
+  bimap_t maps_[2];
+  std::atomic<size_t> reading_{0};
+  std::atomic<size_t> version_{0};
+  mutable bimap_concurrent::read_indicator indicators_[2];
+  std::mutex writer_;
+};
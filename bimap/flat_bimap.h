@@ -0,0 +1,134 @@
+#pragma once
+
+#include "bimap.h"
+#include "bimap_flat.h"
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// bimap для данных, которые строятся один раз и много читаются. Пары лежат
+// в двух непрерывных массивах, отсортированных по левым элементам, правая
+// сторона -- массив 32-битных позиций, отсортированный по правым. Поиск --
+// бинарный без ветвлений, итераторы произвольного доступа, flip() за O(1).
+// Изменять содержимое можно только целиком: присваиванием или assign.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct flat_bimap : bimap_flat::view<Left, Right, CompareLeft, CompareRight> {
+private:
+  using view_t = bimap_flat::view<Left, Right, CompareLeft, CompareRight>;
+  using arrays_t = bimap_flat::arrays<Left, Right>;
+
+public:
+  explicit flat_bimap(CompareLeft compare_left = CompareLeft(),
+                      CompareRight compare_right = CompareRight())
+      : view_t(std::move(compare_left), std::move(compare_right)) {}
+
+  // Создает flat_bimap из диапазона пар (std::pair, std::tuple, ...). Пары с
+  // повторяющимися элементами отбрасываются так же, как в конструкторе bimap
+  // от диапазона.
+  template <std::input_iterator InputIt>
+  flat_bimap(InputIt first, InputIt last,
+             CompareLeft compare_left = CompareLeft(),
+             CompareRight compare_right = CompareRight())
+      : flat_bimap(std::move(compare_left), std::move(compare_right)) {
+    assign(first, last);
+  }
+
+  flat_bimap(std::initializer_list<std::pair<Left, Right>> pairs,
+             CompareLeft compare_left = CompareLeft(),
+             CompareRight compare_right = CompareRight())
+      : flat_bimap(pairs.begin(), pairs.end(), std::move(compare_left),
+                   std::move(compare_right)) {}
+
+  // По умолчанию берет компараторы other
+  template <typename Allocator, typename Instrumentation>
+  explicit flat_bimap(bimap<Left, Right, CompareLeft, CompareRight, Allocator,
+                            Instrumentation> const& other)
+      : flat_bimap(other, other.left_comparator(), other.right_comparator()) {}
+
+  template <typename Allocator, typename Instrumentation>
+  flat_bimap(bimap<Left, Right, CompareLeft, CompareRight, Allocator,
+                   Instrumentation> const& other,
+             CompareLeft compare_left, CompareRight compare_right)
+      : flat_bimap(std::move(compare_left), std::move(compare_right)) {
+    std::vector<Left> lefts;
+    std::vector<Right> rights;
+    lefts.reserve(other.size());
+    rights.reserve(other.size());
+    for (auto it = other.begin_left(); it != other.end_left(); ++it) {
+      lefts.push_back(*it);
+      rights.push_back(*it.flip());
+    }
+    rebuild(std::move(lefts), std::move(rights));
+  }
+
+  flat_bimap(flat_bimap const& other) : view_t(other), data_(other.data_) {
+    relink();
+  }
+
+  flat_bimap(flat_bimap&& other) noexcept
+      : view_t(other), data_(std::move(other.data_)) {
+    relink();
+    other.relink();
+  }
+
+  flat_bimap& operator=(flat_bimap const& other) {
+    if (this != &other) {
+      flat_bimap(other).swap(*this);
+    }
+    return *this;
+  }
+
+  flat_bimap& operator=(flat_bimap&& other) noexcept {
+    if (this != &other) {
+      flat_bimap(std::move(other)).swap(*this);
+    }
+    return *this;
+  }
+
+  void swap(flat_bimap& other) noexcept {
+    std::swap(static_cast<view_t&>(*this), static_cast<view_t&>(other));
+    std::swap(data_, other.data_);
+    relink();
+    other.relink();
+  }
+
+  friend void swap(flat_bimap& a, flat_bimap& b) noexcept {
+    a.swap(b);
+  }
+
+  // Заменяет содержимое парами из диапазона, инвалидирует итераторы
+  template <std::input_iterator InputIt>
+  void assign(InputIt first, InputIt last) {
+    std::vector<Left> lefts;
+    std::vector<Right> rights;
+    if constexpr (std::forward_iterator<InputIt>) {
+      size_t n = std::distance(first, last);
+      lefts.reserve(n);
+      rights.reserve(n);
+    }
+    for (; first != last; ++first) {
+      auto&& pair = *first;
+      lefts.push_back(std::get<0>(std::forward<decltype(pair)>(pair)));
+      rights.push_back(std::get<1>(std::forward<decltype(pair)>(pair)));
+    }
+    rebuild(std::move(lefts), std::move(rights));
+  }
+
+private:
+  void rebuild(std::vector<Left> lefts, std::vector<Right> rights) {
+    data_ = arrays_t::build(std::move(lefts), std::move(rights),
+                            this->compare_left_, this->compare_right_);
+    relink();
+  }
+
+  void relink() {
+    this->reset(data_.lefts_.data(), data_.rights_.data(),
+                data_.order_.data(), data_.rank_.data(), data_.lefts_.size());
+  }
+
+  arrays_t data_;
+};
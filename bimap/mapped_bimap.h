@@ -0,0 +1,249 @@
+#pragma once
+
+#include "bimap.h"
+#include "bimap_flat.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace bimap_mapped {
+
+using bimap_flat::index_t;
+
+// The file is a header followed by four arrays at the offsets it names:
+// lefts sorted by left, rights in the same order, positions sorted by right
+// and the inverse of that permutation. Offsets are relative to the start of
+// the file, so it can be mapped at any address. Numbers are stored in the
+// byte order of the writer, which is checked on load.
+struct file_header {
+  static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'F', 'L', '1'};
+  static constexpr uint32_t byte_order_mark = 0x01020304;
+
+  template <typename L, typename R>
+  static file_header layout(uint64_t count) {
+    file_header res;
+    std::memcpy(res.magic_, signature, sizeof(signature));
+    res.byte_order_ = byte_order_mark;
+    res.index_size_ = sizeof(index_t);
+    res.left_size_ = sizeof(L);
+    res.left_align_ = alignof(L);
+    res.right_size_ = sizeof(R);
+    res.right_align_ = alignof(R);
+    res.count_ = count;
+    uint64_t end = sizeof(file_header);
+    auto place = [&](uint64_t size, uint64_t align) {
+      uint64_t offset = (end + align - 1) / align * align;
+      end = offset + size * count;
+      return offset;
+    };
+    res.lefts_ = place(sizeof(L), alignof(L));
+    res.rights_ = place(sizeof(R), alignof(R));
+    res.order_ = place(sizeof(index_t), alignof(index_t));
+    res.rank_ = place(sizeof(index_t), alignof(index_t));
+    res.file_size_ = end;
+    return res;
+  }
+
+  bool operator==(file_header const& other) const = default;
+
+  char magic_[8];
+  uint32_t byte_order_;
+  uint32_t index_size_;
+  uint64_t left_size_;
+  uint64_t left_align_;
+  uint64_t right_size_;
+  uint64_t right_align_;
+  uint64_t count_;
+  uint64_t lefts_;
+  uint64_t rights_;
+  uint64_t order_;
+  uint64_t rank_;
+  uint64_t file_size_;
+};
+
+template <typename L, typename R>
+void write(bimap_flat::arrays<L, R> const& data, std::ostream& out) {
+  static_assert(std::is_trivially_copyable_v<L> &&
+                    std::is_trivially_copyable_v<R>,
+                "only trivially copyable elements can be mapped");
+  file_header header = file_header::layout<L, R>(data.lefts_.size());
+  uint64_t written = 0;
+  auto put = [&](uint64_t offset, void const* bytes, uint64_t size) {
+    static constexpr char zeros[64] = {};
+    while (written < offset) {
+      uint64_t n = std::min<uint64_t>(offset - written, sizeof(zeros));
+      out.write(zeros, n);
+      written += n;
+    }
+    out.write(static_cast<char const*>(bytes), size);
+    written += size;
+  };
+  put(0, &header, sizeof(header));
+  put(header.lefts_, data.lefts_.data(), sizeof(L) * header.count_);
+  put(header.rights_, data.rights_.data(), sizeof(R) * header.count_);
+  put(header.order_, data.order_.data(), sizeof(index_t) * header.count_);
+  put(header.rank_, data.rank_.data(), sizeof(index_t) * header.count_);
+  if (!out) {
+    throw std::runtime_error("failed to write bimap file");
+  }
+}
+
+// Read-only private mapping of a whole file
+struct mapping {
+  explicit mapping(std::string const& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ != 0) {
+      void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+      }
+      data_ = data;
+    }
+    ::close(fd);
+  }
+
+  mapping(mapping&& other) noexcept
+      : data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  mapping& operator=(mapping&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+
+  ~mapping() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<void*>(data_), size_);
+    }
+  }
+
+  char const* data() const {
+    return static_cast<char const*>(data_);
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  void const* data_{nullptr};
+  size_t size_{0};
+};
+} // namespace bimap_mapped
+
+// bimap только для чтения поверх файла, отображенного в память. Файл
+// записывается функцией write из обычного bimap и больше не разбирается:
+// поиск идет прямо по страницам файла. Элементы должны быть тривиально
+// копируемыми, файл читается только на машине с тем же порядком байт и
+// теми же типами элементов.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct mapped_bimap
+    : bimap_flat::view<Left, Right, CompareLeft, CompareRight> {
+private:
+  static_assert(std::is_trivially_copyable_v<Left> &&
+                    std::is_trivially_copyable_v<Right>,
+                "only trivially copyable elements can be mapped");
+
+  using view_t = bimap_flat::view<Left, Right, CompareLeft, CompareRight>;
+  using index_t = bimap_flat::index_t;
+  using header_t = bimap_mapped::file_header;
+
+public:
+  // Если файл не открывается -- бросает std::system_error, если он не
+  // подходит к этим типам -- std::runtime_error
+  explicit mapped_bimap(std::string const& path,
+                        CompareLeft compare_left = CompareLeft(),
+                        CompareRight compare_right = CompareRight())
+      : view_t(std::move(compare_left), std::move(compare_right)),
+        file_(path) {
+    header_t header;
+    if (file_.size() < sizeof(header)) {
+      throw std::runtime_error(path + ": not a bimap file");
+    }
+    std::memcpy(&header, file_.data(), sizeof(header));
+    if (header.count_ > std::numeric_limits<index_t>::max() ||
+        !(header == header_t::layout<Left, Right>(header.count_)) ||
+        header.file_size_ != file_.size()) {
+      throw std::runtime_error(path + ": not a bimap file of these types");
+    }
+    this->reset(section<Left>(header.lefts_), section<Right>(header.rights_),
+                section<index_t>(header.order_),
+                section<index_t>(header.rank_), header.count_);
+  }
+
+  // Перемещение инвалидирует итераторы
+  mapped_bimap(mapped_bimap&& other) noexcept
+      : view_t(std::move(other)), file_(std::move(other.file_)) {
+    other.reset(nullptr, nullptr, nullptr, nullptr, 0);
+  }
+
+  mapped_bimap& operator=(mapped_bimap&& other) noexcept {
+    if (this != &other) {
+      view_t::operator=(std::move(other));
+      file_ = std::move(other.file_);
+      other.reset(nullptr, nullptr, nullptr, nullptr, 0);
+    }
+    return *this;
+  }
+
+  // Записывает bimap в файл в формате, который читает mapped_bimap
+  template <typename Allocator, typename Instrumentation>
+  static void write(bimap<Left, Right, CompareLeft, CompareRight, Allocator,
+                          Instrumentation> const& map,
+                    std::string const& path) {
+    std::vector<Left> lefts;
+    std::vector<Right> rights;
+    lefts.reserve(map.size());
+    rights.reserve(map.size());
+    for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+      lefts.push_back(*it);
+      rights.push_back(*it.flip());
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+    bimap_mapped::write(bimap_flat::arrays<Left, Right>::build(
+                            std::move(lefts), std::move(rights),
+                            map.left_comparator(), map.right_comparator()),
+                        out);
+  }
+
+private:
+  template <typename T>
+  T const* section(uint64_t offset) const {
+    return reinterpret_cast<T const*>(file_.data() + offset);
+  }
+
+  bimap_mapped::mapping file_;
+};
@@ -0,0 +1,560 @@
+#pragma once
+
+#include "bimap_nodes.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+namespace bimap_persistent {
+
+// Versions share nodes, so nodes and pairs are freed by reference counting.
+// The counters are atomic: versions may be handed to other threads.
+template <typename T>
+void retain(T const* ptr) {
+  if (ptr != nullptr) {
+    ptr->refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+void release(T const* ptr) {
+  if (ptr != nullptr &&
+      ptr->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete ptr;
+  }
+}
+
+// Owning reference, adopts the pointer it is constructed from
+template <typename T>
+struct ref {
+  ref() = default;
+
+  explicit ref(T const* ptr) : ptr_(ptr) {}
+
+  ref(ref const& other) : ptr_(other.ptr_) {
+    retain(ptr_);
+  }
+
+  ref(ref&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)) {}
+
+  ref& operator=(ref other) noexcept {
+    std::swap(ptr_, other.ptr_);
+    return *this;
+  }
+
+  ~ref() {
+    release(ptr_);
+  }
+
+  T const* get() const {
+    return ptr_;
+  }
+
+  T const* operator->() const {
+    return ptr_;
+  }
+
+private:
+  T const* ptr_{nullptr};
+};
+
+template <typename L, typename R>
+struct pair_block {
+  template <typename A, typename B>
+  pair_block(A&& left, B&& right)
+      : l_element(std::forward<A>(left)), r_element(std::forward<B>(right)) {}
+
+  mutable std::atomic<size_t> refs_{1};
+  L l_element;
+  R r_element;
+};
+
+template <typename Tag, typename Pair>
+auto const& element(Pair const* pair) {
+  if constexpr (nodes::is_left<Tag>) {
+    return pair->l_element;
+  } else {
+    return pair->r_element;
+  }
+}
+
+// Immutable AVL node. A new node holds references to its children and pair.
+template <typename Pair, typename Tag>
+struct tree_node {
+  tree_node(tree_node const* left, Pair const* pair, tree_node const* right)
+      : left_(left), right_(right), pair_(pair),
+        height_(1 + std::max(height(left), height(right))) {
+    retain(left_);
+    retain(right_);
+    retain(pair_);
+  }
+
+  ~tree_node() {
+    release(left_);
+    release(right_);
+    release(pair_);
+  }
+
+  static int height(tree_node const* ptr) {
+    return ptr == nullptr ? 0 : ptr->height_;
+  }
+
+  mutable std::atomic<size_t> refs_{1};
+  tree_node const* left_;
+  tree_node const* right_;
+  Pair const* pair_;
+  int height_;
+};
+
+// Path copying over one side: insert and erase build new nodes along one
+// root-to-leaf path and share everything else with the old version.
+// All functions borrow their arguments and return owning references.
+template <typename Pair, typename Tag, typename Compare>
+struct tree {
+  using node_t = tree_node<Pair, Tag>;
+  using node_ref = ref<node_t>;
+
+  explicit tree(Compare compare) : compare_(std::move(compare)) {}
+
+  Compare const& key_comp() const {
+    return compare_;
+  }
+
+  template <typename K>
+  node_t const* find(node_t const* t, K const& key) const {
+    while (t != nullptr) {
+      if (compare_(key, element<Tag>(t->pair_))) {
+        t = t->left_;
+      } else if (compare_(element<Tag>(t->pair_), key)) {
+        t = t->right_;
+      } else {
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  // the first node whose key is not less than key (or greater than, if
+  // strict), nullptr if there is none
+  template <typename K>
+  node_t const* bound(node_t const* t, K const& key, bool strict) const {
+    node_t const* res = nullptr;
+    while (t != nullptr) {
+      bool go_left = strict ? compare_(key, element<Tag>(t->pair_))
+                            : !compare_(element<Tag>(t->pair_), key);
+      if (go_left) {
+        res = t;
+        t = t->left_;
+      } else {
+        t = t->right_;
+      }
+    }
+    return res;
+  }
+
+  // the last node whose key is less than key
+  template <typename K>
+  node_t const* before(node_t const* t, K const& key) const {
+    node_t const* res = nullptr;
+    while (t != nullptr) {
+      if (compare_(element<Tag>(t->pair_), key)) {
+        res = t;
+        t = t->right_;
+      } else {
+        t = t->left_;
+      }
+    }
+    return res;
+  }
+
+  static node_t const* minimum(node_t const* t) {
+    while (t != nullptr && t->left_ != nullptr) {
+      t = t->left_;
+    }
+    return t;
+  }
+
+  static node_t const* maximum(node_t const* t) {
+    while (t != nullptr && t->right_ != nullptr) {
+      t = t->right_;
+    }
+    return t;
+  }
+
+  // the key of pair must not be in t
+  node_ref insert(node_t const* t, Pair const* pair) const {
+    if (t == nullptr) {
+      return make(nullptr, pair, nullptr);
+    }
+    if (compare_(element<Tag>(pair), element<Tag>(t->pair_))) {
+      node_ref left = insert(t->left_, pair);
+      return balance(left.get(), t->pair_, t->right_);
+    }
+    node_ref right = insert(t->right_, pair);
+    return balance(t->left_, t->pair_, right.get());
+  }
+
+  // the key must be in t
+  template <typename K>
+  node_ref erase(node_t const* t, K const& key) const {
+    if (compare_(key, element<Tag>(t->pair_))) {
+      node_ref left = erase(t->left_, key);
+      return balance(left.get(), t->pair_, t->right_);
+    }
+    if (compare_(element<Tag>(t->pair_), key)) {
+      node_ref right = erase(t->right_, key);
+      return balance(t->left_, t->pair_, right.get());
+    }
+    if (t->left_ == nullptr || t->right_ == nullptr) {
+      node_t const* child = t->left_ == nullptr ? t->right_ : t->left_;
+      retain(child);
+      return node_ref(child);
+    }
+    node_ref right = erase_minimum(t->right_);
+    return balance(t->left_, minimum(t->right_)->pair_, right.get());
+  }
+
+private:
+  static node_ref make(node_t const* left, Pair const* pair,
+                       node_t const* right) {
+    return node_ref(new node_t(left, pair, right));
+  }
+
+  static node_ref erase_minimum(node_t const* t) {
+    if (t->left_ == nullptr) {
+      retain(t->right_);
+      return node_ref(t->right_);
+    }
+    node_ref left = erase_minimum(t->left_);
+    return balance(left.get(), t->pair_, t->right_);
+  }
+
+  // joins subtrees whose heights differ by at most two
+  static node_ref balance(node_t const* left, Pair const* pair,
+                          node_t const* right) {
+    int hl = node_t::height(left);
+    int hr = node_t::height(right);
+    if (hl > hr + 1) {
+      if (node_t::height(left->left_) >= node_t::height(left->right_)) {
+        node_ref r = make(left->right_, pair, right);
+        return make(left->left_, left->pair_, r.get());
+      }
+      node_t const* lr = left->right_;
+      node_ref l = make(left->left_, left->pair_, lr->left_);
+      node_ref r = make(lr->right_, pair, right);
+      return make(l.get(), lr->pair_, r.get());
+    }
+    if (hr > hl + 1) {
+      if (node_t::height(right->right_) >= node_t::height(right->left_)) {
+        node_ref l = make(left, pair, right->left_);
+        return make(l.get(), right->pair_, right->right_);
+      }
+      node_t const* rl = right->left_;
+      node_ref l = make(left, pair, rl->left_);
+      node_ref r = make(rl->right_, right->pair_, right->right_);
+      return make(l.get(), rl->pair_, r.get());
+    }
+    return make(left, pair, right);
+  }
+
+  [[no_unique_address]] Compare compare_;
+};
+} // namespace bimap_persistent
+
+// Неизменяемый bimap. insert и erase не меняют объект, а возвращают новую
+// версию, которая делит с исходной все узлы, кроме O(log n) скопированных
+// на пути от корня. Копирование версии -- O(1), узлы освобождаются, когда
+// на них не остается ссылок. Версии можно читать из разных потоков.
+// Итераторы валидны, пока жив объект, от которого они получены; переход к
+// соседнему элементу и flip() работают за O(log n).
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct persistent_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+
+  using pair_t = bimap_persistent::pair_block<left_t, right_t>;
+  using left_tree_t =
+      bimap_persistent::tree<pair_t, nodes::left_tag, CompareLeft>;
+  using right_tree_t =
+      bimap_persistent::tree<pair_t, nodes::right_tag, CompareRight>;
+
+  template <typename Tag>
+  using node_t = bimap_persistent::tree_node<pair_t, Tag>;
+
+  template <typename Tag>
+  struct iterator {
+    using value_type = std::conditional_t<nodes::is_left<Tag>, left_t, right_t>;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = ptrdiff_t;
+
+  private:
+    using other_tag = std::conditional_t<nodes::is_left<Tag>, nodes::right_tag,
+                                         nodes::left_tag>;
+
+    iterator(persistent_bimap const* map, node_t<Tag> const* node)
+        : map_(map), node_(node) {}
+
+  public:
+    iterator() = default;
+
+    value_type const& operator*() const {
+      return bimap_persistent::element<Tag>(node_->pair_);
+    }
+    value_type const* operator->() const {
+      return &operator*();
+    }
+
+    iterator& operator++() {
+      node_ = map_->tree_of<Tag>().bound(map_->root_of<Tag>(), **this, true);
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator res = *this;
+      operator++();
+      return res;
+    }
+
+    iterator& operator--() {
+      auto const& tree = map_->tree_of<Tag>();
+      node_ = node_ == nullptr ? tree.maximum(map_->root_of<Tag>())
+                               : tree.before(map_->root_of<Tag>(), **this);
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator res = *this;
+      operator--();
+      return res;
+    }
+
+    iterator<other_tag> flip() const {
+      if (node_ == nullptr) {
+        return {map_, nullptr};
+      }
+      return {map_, map_->tree_of<other_tag>().find(
+                        map_->root_of<other_tag>(),
+                        bimap_persistent::element<other_tag>(node_->pair_))};
+    }
+
+    friend bool operator==(iterator const& a, iterator const& b) {
+      return a.node_ == b.node_;
+    }
+
+    friend bool operator!=(iterator const& a, iterator const& b) {
+      return a.node_ != b.node_;
+    }
+
+    friend struct persistent_bimap;
+
+  private:
+    persistent_bimap const* map_{nullptr};
+    node_t<Tag> const* node_{nullptr};
+  };
+
+public:
+  using left_iterator = iterator<nodes::left_tag>;
+  using right_iterator = iterator<nodes::right_tag>;
+
+  // Пустая версия, не делает аллокаций
+  explicit persistent_bimap(CompareLeft compare_left = CompareLeft(),
+                            CompareRight compare_right = CompareRight())
+      : left_tree_(std::move(compare_left)),
+        right_tree_(std::move(compare_right)) {}
+
+  // Снимок за O(1)
+  persistent_bimap(persistent_bimap const& other) = default;
+  persistent_bimap(persistent_bimap&& other) noexcept
+      : left_tree_(other.left_tree_), right_tree_(other.right_tree_),
+        left_root_(std::move(other.left_root_)),
+        right_root_(std::move(other.right_root_)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  persistent_bimap& operator=(persistent_bimap const& other) = default;
+  persistent_bimap& operator=(persistent_bimap&& other) noexcept {
+    if (this != &other) {
+      left_tree_ = other.left_tree_;
+      right_tree_ = other.right_tree_;
+      left_root_ = std::move(other.left_root_);
+      right_root_ = std::move(other.right_root_);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  // Версия с добавленной парой. Если left или right уже присутствуют,
+  // возвращается копия этой версии.
+  template <typename A, typename B>
+    requires(std::is_constructible_v<left_t, A &&> &&
+             std::is_constructible_v<right_t, B &&>)
+  [[nodiscard]] persistent_bimap insert(A&& left, B&& right) const {
+    if (left_tree_.find(left_root_.get(), left) != nullptr ||
+        right_tree_.find(right_root_.get(), right) != nullptr) {
+      return *this;
+    }
+    bimap_persistent::ref<pair_t> pair(
+        new pair_t(std::forward<A>(left), std::forward<B>(right)));
+    persistent_bimap res(*this);
+    res.left_root_ = left_tree_.insert(left_root_.get(), pair.get());
+    res.right_root_ = right_tree_.insert(right_root_.get(), pair.get());
+    res.size_++;
+    return res;
+  }
+
+  // Версия без пары с таким ключом (или копия этой, если ключа нет)
+  [[nodiscard]] persistent_bimap erase_left(left_t const& left) const {
+    return erase_impl<nodes::left_tag>(left);
+  }
+  [[nodiscard]] persistent_bimap erase_right(right_t const& right) const {
+    return erase_impl<nodes::right_tag>(right);
+  }
+
+  left_iterator find_left(left_t const& left) const {
+    return {this, left_tree_.find(left_root_.get(), left)};
+  }
+  right_iterator find_right(right_t const& right) const {
+    return {this, right_tree_.find(right_root_.get(), right)};
+  }
+
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const& at_left(left_t const& key) const {
+    return at_impl<nodes::left_tag>(key);
+  }
+  left_t const& at_right(right_t const& key) const {
+    return at_impl<nodes::right_tag>(key);
+  }
+
+  left_iterator lower_bound_left(left_t const& left) const {
+    return {this, left_tree_.bound(left_root_.get(), left, false)};
+  }
+  left_iterator upper_bound_left(left_t const& left) const {
+    return {this, left_tree_.bound(left_root_.get(), left, true)};
+  }
+  right_iterator lower_bound_right(right_t const& right) const {
+    return {this, right_tree_.bound(right_root_.get(), right, false)};
+  }
+  right_iterator upper_bound_right(right_t const& right) const {
+    return {this, right_tree_.bound(right_root_.get(), right, true)};
+  }
+
+  left_iterator begin_left() const {
+    return {this, left_tree_t::minimum(left_root_.get())};
+  }
+  left_iterator end_left() const {
+    return {this, nullptr};
+  }
+  right_iterator begin_right() const {
+    return {this, right_tree_t::minimum(right_root_.get())};
+  }
+  right_iterator end_right() const {
+    return {this, nullptr};
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+  friend bool operator==(persistent_bimap const& a,
+                         persistent_bimap const& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (left_iterator it1 = a.begin_left(), it2 = b.begin_left();
+         it1 != a.end_left(); it1++, it2++) {
+      pair_t const* x = pair_of(it1);
+      pair_t const* y = pair_of(it2);
+      if (x != y && (!a.equivalent<nodes::left_tag>(x, y) ||
+                     !a.equivalent<nodes::right_tag>(x, y))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  friend bool operator!=(persistent_bimap const& a,
+                         persistent_bimap const& b) {
+    return !(a == b);
+  }
+
+private:
+  template <typename Tag>
+  static pair_t const* pair_of(iterator<Tag> it) {
+    return it.node_->pair_;
+  }
+
+  template <typename Tag>
+  auto const& tree_of() const {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_tree_;
+    } else {
+      return right_tree_;
+    }
+  }
+
+  template <typename Tag>
+  node_t<Tag> const* root_of() const {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_root_.get();
+    } else {
+      return right_root_.get();
+    }
+  }
+
+  template <typename Tag>
+  auto& root_ref() {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_root_;
+    } else {
+      return right_root_;
+    }
+  }
+
+  template <typename Tag>
+  bool equivalent(pair_t const* x, pair_t const* y) const {
+    auto const& less = tree_of<Tag>().key_comp();
+    auto const& a = bimap_persistent::element<Tag>(x);
+    auto const& b = bimap_persistent::element<Tag>(y);
+    return !less(a, b) && !less(b, a);
+  }
+
+  template <typename Tag, typename K>
+  auto const& at_impl(K const& key) const {
+    node_t<Tag> const* node = tree_of<Tag>().find(root_of<Tag>(), key);
+    if (node == nullptr) {
+      throw std::out_of_range("No such key");
+    }
+    using other_tag = typename iterator<Tag>::other_tag;
+    return bimap_persistent::element<other_tag>(node->pair_);
+  }
+
+  template <typename Tag, typename K>
+  persistent_bimap erase_impl(K const& key) const {
+    using other_tag = typename iterator<Tag>::other_tag;
+    node_t<Tag> const* node = tree_of<Tag>().find(root_of<Tag>(), key);
+    if (node == nullptr) {
+      return *this;
+    }
+    persistent_bimap res(*this);
+    res.root_ref<Tag>() = tree_of<Tag>().erase(root_of<Tag>(), key);
+    res.root_ref<other_tag>() = tree_of<other_tag>().erase(
+        root_of<other_tag>(),
+        bimap_persistent::element<other_tag>(node->pair_));
+    res.size_--;
+    return res;
+  }
+
+  left_tree_t left_tree_;
+  right_tree_t right_tree_;
+  bimap_persistent::ref<node_t<nodes::left_tag>> left_root_;
+  bimap_persistent::ref<node_t<nodes::right_tag>> right_root_;
+  size_t size_{0};
+};
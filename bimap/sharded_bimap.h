@@ -0,0 +1,230 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+// bimap для многих писателей: пары распределены по независимым шардам со
+// своими мьютексами. Левый элемент пары хранится в шарде, выбранном по его
+// хешу, правый -- в шарде по хешу правого, так что уникальность каждой
+// стороны проверяется внутри одного шарда. Вставка и удаление блокируют не
+// больше двух шардов, поиск -- один.
+// size() складывает размеры шардов и при параллельных изменениях
+// приблизителен.
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>,
+          typename EqualLeft = std::equal_to<Left>,
+          typename EqualRight = std::equal_to<Right>>
+struct sharded_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+
+  struct alignas(64) shard {
+    shard(HashLeft const& hash_left, EqualLeft const& equal_left,
+          HashRight const& hash_right, EqualRight const& equal_right)
+        : lefts_(0, hash_left, equal_left),
+          rights_(0, hash_right, equal_right) {}
+
+    std::mutex mutex_;
+    std::unordered_map<left_t, right_t, HashLeft, EqualLeft> lefts_;
+    std::unordered_map<right_t, left_t, HashRight, EqualRight> rights_;
+  };
+
+public:
+  // Количество шардов округляется вверх до степени двойки. Хеши и
+  // равенства используются и для выбора шарда, и внутри каждого шарда.
+  explicit sharded_bimap(size_t shard_count = 64,
+                         HashLeft hash_left = HashLeft(),
+                         HashRight hash_right = HashRight(),
+                         EqualLeft equal_left = EqualLeft(),
+                         EqualRight equal_right = EqualRight())
+      : shard_bits_(std::bit_width(std::bit_ceil(shard_count)) - 1),
+        hash_left_(std::move(hash_left)), hash_right_(std::move(hash_right)) {
+    for (size_t i = 0; i < this->shard_count(); i++) {
+      shards_.emplace_back(hash_left_, equal_left, hash_right_, equal_right);
+    }
+  }
+
+  sharded_bimap(sharded_bimap const& other) = delete;
+  sharded_bimap& operator=(sharded_bimap const& other) = delete;
+
+  // Вставляет пару, если ни left, ни right еще не присутствуют
+  bool insert(left_t const& left, right_t const& right) {
+    shard& l = left_shard(left);
+    shard& r = right_shard(right);
+    shard_lock lock(l, r);
+    if (l.lefts_.contains(left) || r.rights_.contains(right)) {
+      return false;
+    }
+    auto it = l.lefts_.emplace(left, right).first;
+    try {
+      r.rights_.emplace(right, left);
+    } catch (...) {
+      l.lefts_.erase(it);
+      throw;
+    }
+    return true;
+  }
+
+  // Удаляет пару по ключу, возвращает была ли пара удалена
+  bool erase_left(left_t const& left) {
+    return erase_impl<true>(left);
+  }
+  bool erase_right(right_t const& right) {
+    return erase_impl<false>(right);
+  }
+
+  // Возвращают копию противоположного элемента
+  std::optional<right_t> find_left(left_t const& left) const {
+    shard& s = left_shard(left);
+    std::lock_guard lock(s.mutex_);
+    auto it = s.lefts_.find(left);
+    if (it == s.lefts_.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+  std::optional<left_t> find_right(right_t const& right) const {
+    shard& s = right_shard(right);
+    std::lock_guard lock(s.mutex_);
+    auto it = s.rights_.find(right);
+    if (it == s.rights_.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t at_left(left_t const& left) const {
+    std::optional<right_t> res = find_left(left);
+    if (!res) {
+      throw std::out_of_range("No such key");
+    }
+    return std::move(*res);
+  }
+  left_t at_right(right_t const& right) const {
+    std::optional<left_t> res = find_right(right);
+    if (!res) {
+      throw std::out_of_range("No such key");
+    }
+    return std::move(*res);
+  }
+
+  size_t size() const {
+    size_t res = 0;
+    for (size_t i = 0; i < shard_count(); i++) {
+      std::lock_guard lock(shards_[i].mutex_);
+      res += shards_[i].lefts_.size();
+    }
+    return res;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t shard_count() const {
+    return size_t(1) << shard_bits_;
+  }
+
+private:
+  // std::hash of integers is the identity, so the bits are mixed first
+  size_t shard_index(size_t hash) const {
+    if (shard_bits_ == 0) {
+      return 0;
+    }
+    return static_cast<size_t>(static_cast<uint64_t>(hash) *
+                               0x9E3779B97F4A7C15ull >>
+                               (64 - shard_bits_));
+  }
+
+  shard& left_shard(left_t const& left) const {
+    return shards_[shard_index(hash_left_(left))];
+  }
+
+  shard& right_shard(right_t const& right) const {
+    return shards_[shard_index(hash_right_(right))];
+  }
+
+  template <bool ByLeft, typename K>
+  shard& shard_of(K const& key) const {
+    if constexpr (ByLeft) {
+      return left_shard(key);
+    } else {
+      return right_shard(key);
+    }
+  }
+
+  // holds the mutexes of one or two shards, std::lock avoids deadlocks
+  // whatever the order
+  struct shard_lock {
+    shard_lock(shard& a, shard& b) : first_(a.mutex_, std::defer_lock) {
+      if (&a == &b) {
+        first_.lock();
+      } else {
+        second_ = std::unique_lock<std::mutex>(b.mutex_, std::defer_lock);
+        std::lock(first_, second_);
+      }
+    }
+
+    std::unique_lock<std::mutex> first_;
+    std::unique_lock<std::mutex> second_;
+  };
+
+  // The shard of the opposite element is known only after a lookup, so it is
+  // found under one lock and rechecked once both are held.
+  template <bool ByLeft, typename K>
+  bool erase_impl(K const& key) {
+    while (true) {
+      shard& own = shard_of<ByLeft>(key);
+      auto& own_map = side_of<ByLeft>(own);
+      std::optional<std::remove_cvref_t<decltype(own_map.begin()->second)>>
+          other_key;
+      {
+        std::lock_guard lock(own.mutex_);
+        auto it = own_map.find(key);
+        if (it == own_map.end()) {
+          return false;
+        }
+        other_key.emplace(it->second);
+      }
+      shard& other = shard_of<!ByLeft>(*other_key);
+      auto& other_map = side_of<!ByLeft>(other);
+      shard_lock lock(own, other);
+      auto it = own_map.find(key);
+      if (it == own_map.end()) {
+        return false;
+      }
+      if (!other_map.key_eq()(it->second, *other_key)) {
+        // the pair was replaced while no locks were held
+        continue;
+      }
+      other_map.erase(*other_key);
+      own_map.erase(it);
+      return true;
+    }
+  }
+
+  template <bool ByLeft>
+  static auto& side_of(shard& s) {
+    if constexpr (ByLeft) {
+      return s.lefts_;
+    } else {
+      return s.rights_;
+    }
+  }
+
+  int shard_bits_;
+  // a deque constructs shards in place, they can't be moved
+  mutable std::deque<shard> shards_;
+  [[no_unique_address]] HashLeft hash_left_;
+  [[no_unique_address]] HashRight hash_right_;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "bimap_flat.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+// bimap фиксированного размера для таблиц, известных во время компиляции
+// (enum <-> строка и т.п.). Строится constexpr из списка пар через
+// make_static_bimap, живет в статической памяти без аллокаций и без работы
+// при старте программы. Пары лежат в массивах, отсортированных по левым
+// элементам, плюс перестановка, сортирующая их по правым; поиск -- бинарный
+// без ветвлений. Элементы должны быть литеральными типами, компараторы --
+// constexpr.
+template <typename Left, typename Right, size_t N,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+struct static_bimap {
+private:
+  using index_t = bimap_flat::index_t;
+  using pair_t = std::pair<Left, Right>;
+
+  static_assert(N <= std::numeric_limits<index_t>::max(),
+                "too many pairs for a static bimap");
+
+public:
+  // Ни левые, ни правые элементы не должны повторяться, иначе бросает
+  // std::invalid_argument, а в constexpr контексте не компилируется.
+  constexpr explicit static_bimap(pair_t const (&pairs)[N],
+                                  CompareLeft compare_left = CompareLeft(),
+                                  CompareRight compare_right = CompareRight())
+      : static_bimap(pairs, sorted_by_left(pairs, compare_left),
+                     compare_left, compare_right,
+                     std::make_index_sequence<N>()) {}
+
+  // Указатель на парный элемент или nullptr, если элемента нет
+  constexpr Right const* find_left(Left const& key) const {
+    size_t i = bimap_flat::partition_point(
+        N, [&](size_t k) { return compare_left_(lefts_[k], key); });
+    if (i == N || compare_left_(key, lefts_[i])) {
+      return nullptr;
+    }
+    return &rights_[i];
+  }
+  constexpr Left const* find_right(Right const& key) const {
+    size_t j = bimap_flat::partition_point(N, [&](size_t k) {
+      return compare_right_(rights_[order_[k]], key);
+    });
+    if (j == N || compare_right_(key, rights_[order_[j]])) {
+      return nullptr;
+    }
+    return &lefts_[order_[j]];
+  }
+
+  // Если элемента не существует -- бросает std::out_of_range
+  constexpr Right const& at_left(Left const& key) const {
+    Right const* res = find_left(key);
+    if (res == nullptr) {
+      throw std::out_of_range("No such key");
+    }
+    return *res;
+  }
+  constexpr Left const& at_right(Right const& key) const {
+    Left const* res = find_right(key);
+    if (res == nullptr) {
+      throw std::out_of_range("No such key");
+    }
+    return *res;
+  }
+
+  constexpr bool contains_left(Left const& key) const {
+    return find_left(key) != nullptr;
+  }
+  constexpr bool contains_right(Right const& key) const {
+    return find_right(key) != nullptr;
+  }
+
+  // Левые элементы по возрастанию и правые в том же порядке
+  constexpr std::array<Left, N> const& lefts() const {
+    return lefts_;
+  }
+  constexpr std::array<Right, N> const& rights() const {
+    return rights_;
+  }
+
+  constexpr size_t size() const {
+    return N;
+  }
+
+private:
+  static constexpr std::array<index_t, N>
+  sorted_by_left(pair_t const (&pairs)[N], CompareLeft const& compare_left) {
+    std::array<index_t, N> res{};
+    std::iota(res.begin(), res.end(), 0);
+    std::sort(res.begin(), res.end(), [&](index_t a, index_t b) {
+      return compare_left(pairs[a].first, pairs[b].first);
+    });
+    return res;
+  }
+
+  template <size_t... I>
+  constexpr static_bimap(pair_t const (&pairs)[N],
+                         std::array<index_t, N> const& by_left,
+                         CompareLeft compare_left, CompareRight compare_right,
+                         std::index_sequence<I...>)
+      : lefts_{pairs[by_left[I]].first...},
+        rights_{pairs[by_left[I]].second...},
+        compare_left_(std::move(compare_left)),
+        compare_right_(std::move(compare_right)) {
+    std::iota(order_.begin(), order_.end(), 0);
+    std::sort(order_.begin(), order_.end(), [&](index_t a, index_t b) {
+      return compare_right_(rights_[a], rights_[b]);
+    });
+    for (size_t i = 1; i < N; i++) {
+      if (!compare_left_(lefts_[i - 1], lefts_[i]) ||
+          !compare_right_(rights_[order_[i - 1]], rights_[order_[i]])) {
+        throw std::invalid_argument("static_bimap keys must be unique");
+      }
+    }
+  }
+
+  std::array<Left, N> lefts_;
+  std::array<Right, N> rights_;
+  std::array<index_t, N> order_{};
+  [[no_unique_address]] CompareLeft compare_left_;
+  [[no_unique_address]] CompareRight compare_right_;
+};
+
+// Выводит размер из списка пар:
+//   constexpr auto names = make_static_bimap<color, std::string_view>(
+//       {{color::red, "red"}, {color::green, "green"}});
+template <typename Left, typename Right,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>, size_t N>
+constexpr static_bimap<Left, Right, N, CompareLeft, CompareRight>
+make_static_bimap(std::pair<Left, Right> const (&pairs)[N],
+                  CompareLeft compare_left = CompareLeft(),
+                  CompareRight compare_right = CompareRight()) {
+  return static_bimap<Left, Right, N, CompareLeft, CompareRight>(
+      pairs, std::move(compare_left), std::move(compare_right));
+}
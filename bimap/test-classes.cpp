@@ -67,3 +67,25 @@ address_checking_object::operator=(const address_checking_object& other) {
 address_checking_object::~address_checking_object() {
   remove_instance();
 }
+
+size_t counting_resource::allocations() const {
+  return allocations_;
+}
+size_t counting_resource::bytes_in_use() const {
+  return bytes_in_use_;
+}
+void* counting_resource::do_allocate(size_t bytes, size_t alignment) {
+  void* res = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  allocations_++;
+  bytes_in_use_ += bytes;
+  return res;
+}
+void counting_resource::do_deallocate(void* ptr, size_t bytes,
+                                      size_t alignment) {
+  bytes_in_use_ -= bytes;
+  std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+}
+bool counting_resource::do_is_equal(
+    std::pmr::memory_resource const& other) const noexcept {
+  return this == &other;
+}
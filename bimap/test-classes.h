@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <memory_resource>
 #include <unordered_set>
 #include <utility>
 
@@ -90,3 +91,19 @@ public:
   address_checking_object& operator=(address_checking_object const& other);
   ~address_checking_object();
 };
+
+// Forwards to new_delete_resource and counts what goes through it.
+class counting_resource : public std::pmr::memory_resource {
+public:
+  size_t allocations() const;
+  size_t bytes_in_use() const;
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+  bool do_is_equal(std::pmr::memory_resource const& other) const
+      noexcept override;
+
+  size_t allocations_ = 0;
+  size_t bytes_in_use_ = 0;
+};
@@ -1,7 +1,28 @@
+#include <compare>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
 #include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
 
 #include "bimap.h"
+#include "btree_bimap.h"
+#include "concurrent_bimap.h"
+#include "flat_bimap.h"
+#include "persistent_bimap.h"
+#include "sharded_bimap.h"
+#include "static_bimap.h"
 #include "test-classes.h"
+#include "unordered_bimap.h"
+
+// mapped_bimap maps files with POSIX calls
+#if __has_include(<sys/mman.h>)
+#define BIMAP_TEST_MAPPED 1
+#include "mapped_bimap.h"
+#endif
 
 TEST(bimap, leak_check) {
   bimap<unsigned long, unsigned long> b;
@@ -443,6 +464,1273 @@ TEST(bimap, swap) {
   EXPECT_EQ(*b.find_right(3), 3);
 }
 
+TEST(bimap, erase_insert_churn) {
+  {
+    bimap<address_checking_object, int> b;
+    for (int i = 0; i < 1000; i++) {
+      b.insert(i, -i);
+    }
+    for (int round = 0; round < 10; round++) {
+      for (int i = round % 2; i < 1000; i += 2) {
+        EXPECT_TRUE(b.erase_left(i));
+      }
+      EXPECT_EQ(b.size(), 500);
+      for (int i = round % 2; i < 1000; i += 2) {
+        EXPECT_NE(b.insert(i, -i), b.end_left());
+      }
+      EXPECT_EQ(b.size(), 1000);
+    }
+    int expected = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); it++, expected++) {
+      EXPECT_EQ(*it, expected);
+      EXPECT_EQ(*it.flip(), -expected);
+    }
+  }
+  address_checking_object::expect_no_instances();
+}
+
+#if BIMAP_NODE_POOL
+TEST(bimap, pool_reuses_nodes) {
+  bimap<int, int> b;
+  auto it = b.insert(1, 2);
+  int const* address = &*it;
+  b.erase_left(it);
+  EXPECT_EQ(&*b.insert(3, 4), address);
+
+  // nodes from one slab are laid out next to each other
+  int const* next = &*b.insert(5, 6);
+  EXPECT_EQ(std::abs(next - address) * sizeof(int),
+            sizeof(nodes::node<int, int>));
+}
+#endif
+
+#if BIMAP_COMPACT_NODES
+TEST(bimap, compact_nodes) {
+  // three links with the colour in the parent one and a 32-bit size
+  EXPECT_EQ(sizeof(nodes::tree_node), BIMAP_ORDER_STATISTICS ? 32 : 24);
+  nodes::tree_node a;
+  nodes::tree_node b;
+  a.set_red(true);
+  a.set_parent(&b);
+  EXPECT_TRUE(a.red());
+  EXPECT_EQ(a.parent(), &b);
+  a.set_red(false);
+  EXPECT_FALSE(a.red());
+  EXPECT_EQ(a.parent(), &b);
+  a.set_parent(nullptr);
+  EXPECT_EQ(a.parent(), nullptr);
+}
+#endif
+
+TEST(bimap, pmr_allocation) {
+  counting_resource resource;
+  {
+    pmr::bimap<int, int> b(&resource);
+    EXPECT_EQ(resource.allocations(), 0);
+    for (int i = 0; i < 100; i++) {
+      b.insert(i, 100 - i);
+    }
+    EXPECT_NE(resource.allocations(), 0);
+    EXPECT_EQ(b.get_allocator().resource(), &resource);
+    EXPECT_EQ(b.at_left(42), 58);
+  }
+  EXPECT_EQ(resource.bytes_in_use(), 0);
+}
+
+TEST(bimap, pmr_monotonic_arena) {
+  std::pmr::monotonic_buffer_resource arena;
+  pmr::bimap<int, int> b(&arena);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, -i);
+  }
+  b.erase_left(b.begin_left(), b.find_left(500));
+  EXPECT_EQ(b.size(), 500);
+  EXPECT_EQ(*b.begin_right(), -999);
+}
+
+TEST(bimap, pmr_copy_and_move) {
+  counting_resource r1, r2;
+  {
+    pmr::bimap<int, int> a(&r1);
+    a.insert(1, 2);
+    a.insert(3, 4);
+
+    pmr::bimap<int, int> copy(a);
+    EXPECT_EQ(copy.get_allocator().resource(),
+              std::pmr::get_default_resource());
+    pmr::bimap<int, int> extended_copy(a, &r2);
+    EXPECT_EQ(extended_copy.get_allocator().resource(), &r2);
+    EXPECT_EQ(extended_copy, a);
+
+    size_t r1_allocations = r1.allocations();
+    pmr::bimap<int, int> moved(std::move(a));
+    EXPECT_EQ(moved.get_allocator().resource(), &r1);
+    EXPECT_EQ(r1.allocations(), r1_allocations);
+    EXPECT_EQ(moved.size(), 2);
+
+    // allocators differ and are not propagated, so elements are moved
+    pmr::bimap<int, int> c(&r2);
+    c = std::move(moved);
+    EXPECT_EQ(c.get_allocator().resource(), &r2);
+    EXPECT_EQ(c, extended_copy);
+    EXPECT_TRUE(moved.empty());
+
+    c = copy;
+    EXPECT_EQ(c.get_allocator().resource(), &r2);
+    EXPECT_EQ(c, copy);
+
+    pmr::bimap<int, int> d(&r2);
+    d.insert(5, 6);
+    d.swap(extended_copy);
+    EXPECT_EQ(d.size(), 2);
+    EXPECT_EQ(extended_copy.at_left(5), 6);
+  }
+  EXPECT_EQ(r1.bytes_in_use(), 0);
+  EXPECT_EQ(r2.bytes_in_use(), 0);
+}
+
+TEST(bimap, extract_and_insert_node) {
+  {
+    bimap<address_checking_object, int> a;
+    bimap<address_checking_object, int> b;
+    for (int i = 0; i < 100; i++) {
+      a.insert(i, -i);
+    }
+    auto it = a.find_left(42);
+    address_checking_object const* address = &*it;
+    auto nh = a.extract_left(it);
+    EXPECT_EQ(a.size(), 99);
+    EXPECT_EQ(a.find_left(42), a.end_left());
+    ASSERT_FALSE(nh.empty());
+    EXPECT_EQ(nh.left(), 42);
+    EXPECT_EQ(nh.right(), -42);
+
+    auto inserted = b.insert(std::move(nh));
+    EXPECT_TRUE(nh.empty());
+    ASSERT_NE(inserted, b.end_left());
+    EXPECT_EQ(&*inserted, address);
+    EXPECT_EQ(b.at_right(-42), 42);
+
+    // keys can be changed while the node is out
+    nh = a.extract_right(a.find_right(-7));
+    nh.left() = 1000;
+    EXPECT_EQ(*b.insert(std::move(nh)).flip(), -7);
+    EXPECT_EQ(b.at_left(1000), -7);
+
+    // a duplicate leaves the node in the handle
+    a.insert(2000, -42);
+    nh = a.extract_left(a.find_left(2000));
+    EXPECT_EQ(b.insert(std::move(nh)), b.end_left());
+    ASSERT_TRUE(nh);
+    nh = decltype(nh)();
+    EXPECT_EQ(b.insert(std::move(nh)), b.end_left());
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(bimap, node_outlives_its_bimap) {
+  {
+    bimap<address_checking_object, std::string> target;
+    decltype(target)::node_type kept;
+    for (int round = 0; round < 3; round++) {
+      bimap<address_checking_object, std::string> source;
+      for (int i = 0; i < 50; i++) {
+        source.insert(round * 100 + i, std::to_string(round * 100 + i));
+      }
+      target.insert(source.extract_left(source.begin_left()));
+      kept = source.extract_right(source.find_right(std::to_string(round * 100 + 7)));
+      target.erase_left(target.begin_left());
+      target.insert(round * 100 + 1000, "x" + std::to_string(round));
+    }
+    EXPECT_EQ(kept.right(), "207");
+    EXPECT_NE(target.insert(std::move(kept)), target.end_left());
+    EXPECT_EQ(target.size(), 4);
+    EXPECT_EQ(target.at_right("207"), 207);
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(bimap, merge) {
+  {
+    bimap<address_checking_object, int> a;
+    bimap<address_checking_object, int> b;
+    std::map<int, int> expected_a, expected_b;
+    std::mt19937 e;
+    for (int i = 0; i < 1000; i++) {
+      int l = static_cast<int>(e() % 3000);
+      int r = static_cast<int>(e() % 3000);
+      auto& m = i % 2 == 0 ? a : b;
+      if (m.insert(l, r) != m.end_left()) {
+        (i % 2 == 0 ? expected_a : expected_b)[l] = r;
+      }
+    }
+    std::set<address_checking_object const*> moved;
+    for (auto [l, r] : expected_b) {
+      auto it = b.find_left(l);
+      if (a.find_left(l) == a.end_left() && a.find_right(r) == a.end_right()) {
+        moved.insert(&*it);
+      }
+    }
+    size_t total = a.size() + b.size();
+    a.merge(b);
+    EXPECT_EQ(a.size() + b.size(), total);
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      EXPECT_TRUE(a.find_left(*it) != a.end_left() ||
+                  a.find_right(*it.flip()) != a.end_right());
+    }
+    for (auto it = a.begin_left(); it != a.end_left(); ++it) {
+      if (expected_a.count(*it) == 0) {
+        EXPECT_EQ(moved.count(&*it), 1);
+        EXPECT_EQ(expected_b.at(*it), *it.flip());
+      }
+    }
+    EXPECT_EQ(a.size() - expected_a.size(), moved.size());
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(bimap, pmr_merge_and_nodes) {
+  counting_resource r1, r2;
+  {
+    pmr::bimap<int, int> a(&r1);
+    pmr::bimap<int, int> b(&r1);
+    pmr::bimap<int, int> c(&r2);
+    for (int i = 0; i < 100; i++) {
+      a.insert(i, i);
+      b.insert(i + 50, i + 50);
+      c.insert(i + 1000, i + 100);
+    }
+    b.insert(b.extract_left(b.begin_left()));
+    size_t allocations = r1.allocations();
+    a.merge(b);
+    b.insert(a.extract_left(a.begin_left()));
+    a.insert(b.extract_right(b.begin_right()));
+    EXPECT_EQ(r1.allocations(), allocations);
+    EXPECT_EQ(a.size(), 150);
+    EXPECT_EQ(b.size(), 50);
+
+    // different resources, the elements are moved into new nodes
+    a.merge(c);
+    EXPECT_EQ(a.size(), 200);
+    EXPECT_EQ(c.size(), 50);
+    EXPECT_EQ(a.at_left(1099), 199);
+    c.insert(a.extract_left(a.find_left(1099)));
+    EXPECT_EQ(c.at_right(199), 1099);
+    EXPECT_EQ(c.size(), 51);
+  }
+  EXPECT_EQ(r1.bytes_in_use(), 0);
+  EXPECT_EQ(r2.bytes_in_use(), 0);
+}
+
+TEST(bimap, find_batch) {
+  bimap<int, std::string> b;
+  std::mt19937 e;
+  for (int i = 0; i < 5000; i++) {
+    int key = static_cast<int>(e() % 10000);
+    b.insert(key, std::to_string(key));
+  }
+  std::vector<int> lefts;
+  std::vector<std::string> rights;
+  for (int i = 0; i < 1000; i++) {
+    lefts.push_back(static_cast<int>(e() % 10100) - 50);
+    rights.push_back(std::to_string(static_cast<int>(e() % 10100) - 50));
+  }
+  for (size_t count : {size_t(0), size_t(1), size_t(15), size_t(17),
+                       lefts.size()}) {
+    std::vector<bimap<int, std::string>::left_iterator> left_found(count);
+    b.find_left_batch(std::span(lefts.data(), count), left_found);
+    std::vector<bimap<int, std::string>::right_iterator> right_found(count);
+    b.find_right_batch(std::span(rights.data(), count), right_found);
+    for (size_t i = 0; i < count; i++) {
+      ASSERT_EQ(left_found[i], b.find_left(lefts[i]));
+      ASSERT_EQ(right_found[i], b.find_right(rights[i]));
+    }
+  }
+
+  bimap<int, int> empty;
+  std::vector<bimap<int, int>::left_iterator> found(3);
+  empty.find_left_batch(std::vector<int>{1, 2, 3}, found);
+  for (auto it : found) {
+    EXPECT_EQ(it, empty.end_left());
+  }
+  std::vector<bimap<int, int>::right_iterator> short_out(2);
+  EXPECT_THROW(empty.find_right_batch(std::vector<int>{1, 2, 3}, short_out),
+               std::length_error);
+  EXPECT_EQ(short_out[0], (bimap<int, int>::right_iterator()));
+}
+
+namespace {
+struct counting_less {
+  static inline size_t calls = 0;
+
+  bool operator()(int a, int b) const {
+    calls++;
+    return a < b;
+  }
+};
+
+struct counting_three_way {
+  static inline size_t calls = 0;
+
+  std::strong_ordering operator()(int a, int b) const {
+    calls++;
+    return a <=> b;
+  }
+};
+} // namespace
+
+TEST(bimap, insert_comparisons) {
+  bimap<int, int, counting_less, counting_less> b;
+  for (int i = 0; i < 1023; i++) {
+    b.insert(i * 7 % 1023, i);
+  }
+  // a red-black tree with 1023 nodes is at most 20 levels deep, each side
+  // is descended once with one comparison per level plus one extra
+  counting_less::calls = 0;
+  b.insert(5000, 5000);
+  EXPECT_LE(counting_less::calls, 2 * 21);
+
+  counting_less::calls = 0;
+  EXPECT_EQ(b.insert(14, -1), b.end_left());
+  EXPECT_LE(counting_less::calls, 21);
+}
+
+TEST(bimap, hinted_insert_sorted) {
+  bimap<int, int, counting_less, counting_less> b;
+  counting_less::calls = 0;
+  for (int i = 0; i < 10000; i++) {
+    b.insert(b.end_left(), b.end_right(), i, 2 * i);
+  }
+  EXPECT_LE(counting_less::calls, 2 * 10000);
+  EXPECT_EQ(b.size(), 10000);
+
+  // hints pointing at the previously inserted pair work as well
+  bimap<int, int> c;
+  auto it = c.end_left();
+  for (int i = 0; i < 100; i++) {
+    it = c.insert(it, it.flip(), i, -i);
+  }
+  int expected = 0;
+  for (auto i = c.begin_left(); i != c.end_left(); i++, expected++) {
+    EXPECT_EQ(*i, expected);
+    EXPECT_EQ(*i.flip(), -expected);
+  }
+  EXPECT_EQ(expected, 100);
+  EXPECT_EQ(*c.begin_right(), -99);
+}
+
+TEST(bimap, lookup_comparisons) {
+  bimap<int, int, counting_less, counting_three_way> b;
+  for (int i = 0; i < 1023; i++) {
+    b.insert(2 * i, 2 * i);
+  }
+  // one comparison per level and one to check the match
+  counting_less::calls = 0;
+  EXPECT_EQ(*b.find_left(700), 700);
+  EXPECT_LE(counting_less::calls, 21);
+  counting_less::calls = 0;
+  EXPECT_EQ(*b.lower_bound_left(701), 702);
+  EXPECT_EQ(*b.upper_bound_left(702), 704);
+  EXPECT_LE(counting_less::calls, 2 * 20);
+
+  // a three-way comparator needs no extra one
+  counting_three_way::calls = 0;
+  EXPECT_EQ(*b.find_right(700), 700);
+  EXPECT_EQ(b.find_right(701), b.end_right());
+  EXPECT_LE(counting_three_way::calls, 2 * 20);
+  counting_three_way::calls = 0;
+  EXPECT_EQ(*b.lower_bound_right(701), 702);
+  EXPECT_EQ(*b.upper_bound_right(702), 704);
+  EXPECT_EQ(b.upper_bound_right(2044), b.end_right());
+  EXPECT_LE(counting_three_way::calls, 3 * 20);
+}
+
+TEST(bimap, three_way_comparators) {
+  using string_bimap = bimap<std::string, int, std::compare_three_way,
+                             std::compare_three_way>;
+  string_bimap b;
+  bimap<std::string, int> expected;
+  std::mt19937 e;
+  for (int i = 0; i < 1000; i++) {
+    std::string key = std::to_string(e() % 2000);
+    int value = static_cast<int>(e() % 2000);
+    EXPECT_EQ(b.insert(key, value) == b.end_left(),
+              expected.insert(key, value) == expected.end_left());
+  }
+  ASSERT_EQ(b.size(), expected.size());
+  EXPECT_TRUE(std::equal(b.begin_left(), b.end_left(),
+                         expected.begin_left(), expected.end_left()));
+  EXPECT_TRUE(std::equal(b.begin_right(), b.end_right(),
+                         expected.begin_right(), expected.end_right()));
+  for (int i = 0; i < 2000; i++) {
+    std::string key = std::to_string(i);
+    auto it = b.find_left(key);
+    auto expected_it = expected.find_left(key);
+    ASSERT_EQ(it == b.end_left(), expected_it == expected.end_left());
+    if (it != b.end_left()) {
+      EXPECT_EQ(*it.flip(), *expected_it.flip());
+    }
+    EXPECT_EQ(std::distance(b.begin_left(), b.lower_bound_left(key)),
+              std::distance(expected.begin_left(),
+                            expected.lower_bound_left(key)));
+    EXPECT_EQ(std::distance(b.begin_right(), b.upper_bound_right(i)),
+              std::distance(expected.begin_right(),
+                            expected.upper_bound_right(i)));
+  }
+  // compare_three_way is transparent
+  EXPECT_EQ(b.find_left(std::string_view("no such key")), b.end_left());
+  EXPECT_EQ(b.at_right(*b.begin_right()), *b.begin_right().flip());
+}
+
+TEST(bimap, hinted_insert_wrong_hint) {
+  bimap<int, int> b;
+  for (int i = 0; i < 10; i++) {
+    b.insert(i * 10, i * 10);
+  }
+  auto it = b.insert(b.begin_left(), b.end_right(), 55, 5);
+  EXPECT_EQ(*it, 55);
+  EXPECT_EQ(*std::prev(it), 50);
+  EXPECT_EQ(*std::next(it), 60);
+  EXPECT_EQ(*std::next(it.flip()), 10);
+
+  EXPECT_EQ(b.insert(b.find_left(50), b.find_right(50), 50, 7), b.end_left());
+  EXPECT_EQ(b.insert(b.find_left(60), b.find_right(10), 51, 5), b.end_left());
+  EXPECT_EQ(b.insert(b.end_left(), b.end_right(), 90, 100), b.end_left());
+  EXPECT_EQ(b.size(), 11);
+}
+
+TEST(bimap, construct_from_sorted_range) {
+  std::vector<std::pair<int, int>> data;
+  for (int i = 0; i < 10000; i++) {
+    data.emplace_back(i, (i * 7919) % 10000);
+  }
+  bimap<int, int> b(data.begin(), data.end());
+  EXPECT_EQ(b.size(), 10000);
+  auto it = b.begin_left();
+  for (auto const& p : data) {
+    EXPECT_EQ(*it, p.first);
+    EXPECT_EQ(*it.flip(), p.second);
+    it++;
+  }
+  int expected = 0;
+  for (auto r = b.begin_right(); r != b.end_right(); r++) {
+    EXPECT_EQ(*r, expected++);
+  }
+
+  // the trees stay valid red-black trees after further modifications
+  for (int i = 0; i < 10000; i += 2) {
+    b.erase_left(i);
+  }
+  for (int i = 10000; i < 15000; i++) {
+    b.insert(i, i);
+  }
+  EXPECT_EQ(b.size(), 10000);
+  EXPECT_EQ(b.at_right(14999), 14999);
+}
+
+TEST(bimap, construct_from_range_duplicates) {
+  std::vector<std::tuple<int, int>> data = {
+      {5, 1}, {1, 2}, {3, 3}, {1, 4}, {4, 3}, {2, 5}, {0, 5}};
+  bimap<int, int> b(data.begin(), data.end());
+  // (1, 4) repeats a left key, (4, 3) and (2, 5) repeat right keys of pairs
+  // with smaller left keys
+  bimap<int, int> expected;
+  expected.insert(0, 5);
+  expected.insert(1, 2);
+  expected.insert(3, 3);
+  expected.insert(5, 1);
+  EXPECT_EQ(b, expected);
+}
+
+TEST(bimap, assign_sorted) {
+  bimap<int, test_object> b;
+  b.insert(100, test_object(100));
+
+  std::vector<std::pair<int, test_object>> data;
+  for (int i = 0; i < 100; i++) {
+    data.emplace_back(i, test_object(100 - i));
+  }
+  b.assign_sorted(std::make_move_iterator(data.begin()),
+                  std::make_move_iterator(data.end()));
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(data[10].second.a, 0);
+  EXPECT_EQ(b.at_left(10), test_object(90));
+  EXPECT_EQ(b.at_right(test_object(1)), 99);
+  EXPECT_EQ(b.find_left(100), b.end_left());
+
+  b.assign_sorted(std::make_move_iterator(data.end()),
+                  std::make_move_iterator(data.end()));
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+}
+
+TEST(bimap, throwing_in_range_constructor) {
+  {
+    std::vector<std::pair<address_checking_object, int>> data;
+    for (int i = 0; i < 10; i++) {
+      data.emplace_back(i, i);
+    }
+    address_checking_object::set_copy_throw_countdown(5);
+    EXPECT_THROW((bimap<address_checking_object, int>(data.begin(),
+                                                      data.end())),
+                 std::runtime_error);
+
+    bimap<address_checking_object, int> b;
+    b.insert(42, 42);
+    address_checking_object::set_copy_throw_countdown(5);
+    EXPECT_THROW(b.assign_sorted(data.begin(), data.end()),
+                 std::runtime_error);
+    EXPECT_TRUE(b.empty());
+    b.insert(1, 1);
+    EXPECT_EQ(b.size(), 1);
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(bimap, copy_clones_structure) {
+  bimap<int, int, counting_less, counting_less> a;
+  std::mt19937 e;
+  for (int i = 0; i < 5000; i++) {
+    a.insert(static_cast<int>(e() % 100000), static_cast<int>(e() % 100000));
+  }
+  counting_less::calls = 0;
+  bimap<int, int, counting_less, counting_less> b = a;
+  EXPECT_EQ(counting_less::calls, 0);
+  EXPECT_EQ(b.size(), a.size());
+  for (auto it = b.begin_right(), other = a.begin_right();
+       it != b.end_right(); it++, other++) {
+    EXPECT_EQ(*it, *other);
+    EXPECT_EQ(*it.flip(), *other.flip());
+    EXPECT_NE(&*it, &*other);
+  }
+
+  // both copies keep working on their own
+  for (int i = 0; i < 5000; i++) {
+    b.erase_left(b.begin_left());
+    b.insert(100000 + i, -i - 1);
+  }
+  EXPECT_EQ(b.size(), a.size());
+  EXPECT_EQ(*b.begin_right(), -5000);
+  EXPECT_NE(a, b);
+
+  bimap<int, int, counting_less, counting_less> empty, empty_copy = empty;
+  EXPECT_TRUE(empty_copy.empty());
+  EXPECT_EQ(empty_copy.begin_left(), empty_copy.end_left());
+  empty_copy.insert(1, 1);
+  EXPECT_EQ(empty_copy.size(), 1);
+}
+
+TEST(bimap, heterogeneous_lookup) {
+  // std::string is not implicitly constructible from std::string_view, so
+  // these calls compile only if no temporary key is made
+  bimap<std::string, std::string, std::less<>, std::less<>> b;
+  b.insert("apple", "red");
+  b.insert("banana", "yellow");
+  b.insert("cherry", "dark red");
+  std::string_view apple = "apple";
+  std::string_view yellow = "yellow";
+
+  EXPECT_EQ(*b.find_left(apple).flip(), "red");
+  EXPECT_EQ(b.find_left(std::string_view("kiwi")), b.end_left());
+  EXPECT_EQ(*b.find_right(yellow).flip(), "banana");
+  EXPECT_EQ(b.at_left(apple), "red");
+  EXPECT_EQ(b.at_right(yellow), "banana");
+  EXPECT_THROW(b.at_right(std::string_view("blue")), std::out_of_range);
+
+  EXPECT_EQ(*b.lower_bound_left(std::string_view("b")), "banana");
+  EXPECT_EQ(*b.upper_bound_left(std::string_view("banana")), "cherry");
+  EXPECT_EQ(*b.lower_bound_right(std::string_view("red")), "red");
+  EXPECT_EQ(b.upper_bound_right(yellow), b.end_right());
+
+  EXPECT_TRUE(b.erase_left(apple));
+  EXPECT_FALSE(b.erase_left(apple));
+  EXPECT_TRUE(b.erase_right(yellow));
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_left("cherry"), "dark red");
+
+  // iterators still pick the erase by iterator overload
+  b.erase_left(b.begin_left());
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(btree_bimap, simple) {
+  btree_bimap<int, int> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(*b.insert(4, 3), 4);
+  b.insert(1, 5);
+  b.insert(7, 1);
+  EXPECT_EQ(b.insert(4, 10), b.end_left());
+  EXPECT_EQ(b.insert(10, 5), b.end_left());
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_left(1), 5);
+  EXPECT_EQ(b.at_right(1), 7);
+  EXPECT_THROW(b.at_left(5), std::out_of_range);
+  EXPECT_EQ(*b.find_left(7).flip(), 1);
+  EXPECT_EQ(*b.find_right(3).flip(), 4);
+  EXPECT_EQ(b.end_right().flip(), b.end_left());
+  EXPECT_EQ(*b.lower_bound_left(2), 4);
+  EXPECT_EQ(*b.upper_bound_right(3), 5);
+  EXPECT_EQ(b.upper_bound_left(7), b.end_left());
+  EXPECT_EQ(*--b.end_right(), 5);
+
+  EXPECT_EQ(b.at_left_or_default(8), 0);
+  EXPECT_EQ(b.at_right_or_default(0), 8);
+  EXPECT_EQ(b.at_left_or_default(9), 0);
+  EXPECT_EQ(b.find_left(8), b.end_left());
+  EXPECT_EQ(b.at_right(0), 9);
+
+  EXPECT_EQ(*b.erase_left(b.find_left(4)), 7);
+  EXPECT_TRUE(b.erase_right(1));
+  EXPECT_FALSE(b.erase_left(7));
+  EXPECT_EQ(b.size(), 2);
+  b.clear();
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(btree_bimap, compare_to_two_maps) {
+  // strings get the narrowest nodes, so the trees are deep
+  btree_bimap<std::string, int> b;
+  std::map<std::string, int> left_view;
+  std::map<int, std::string> right_view;
+
+  std::mt19937 e;
+  for (size_t i = 0; i < 100000; i++) {
+    std::string l = std::to_string(e() % 3000);
+    int r = static_cast<int>(e() % 3000);
+    if (e() % 2 != 0) {
+      bool inserted = b.insert(l, r) != b.end_left();
+      EXPECT_EQ(inserted,
+                left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (right_view.count(r) != 0) {
+      auto it = b.erase_right(b.find_right(r));
+      auto expected = right_view.upper_bound(r);
+      EXPECT_EQ(it == b.end_right(), expected == right_view.end());
+      if (expected != right_view.end()) {
+        EXPECT_EQ(*it, expected->first);
+      }
+      left_view.erase(right_view[r]);
+      right_view.erase(r);
+    }
+    if (i % 5000 == 0) {
+      ASSERT_EQ(b.size(), left_view.size());
+      auto it = b.begin_left();
+      for (auto const& [key, value] : left_view) {
+        ASSERT_EQ(*it, key);
+        ASSERT_EQ(*it.flip(), value);
+        ASSERT_EQ(it.flip().flip(), it);
+        it++;
+      }
+      ASSERT_EQ(it, b.end_left());
+      auto rit = b.end_right();
+      for (auto i = right_view.rbegin(); i != right_view.rend(); ++i) {
+        ASSERT_EQ(*--rit, i->first);
+      }
+    }
+  }
+}
+
+TEST(btree_bimap, erase_range) {
+  btree_bimap<int, int> b;
+  for (int i = 0; i < 100000; i++) {
+    b.insert(i, -i);
+  }
+  auto it = b.erase_left(b.find_left(1000), b.find_left(90000));
+  EXPECT_EQ(*it, 90000);
+  EXPECT_EQ(b.size(), 11000);
+  EXPECT_EQ(b.at_right(-999), 999);
+  EXPECT_EQ(b.find_right(-1000), b.end_right());
+  EXPECT_EQ(*b.lower_bound_right(-89999), -999);
+  b.erase_right(b.begin_right(), b.end_right());
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(btree_bimap, copy_move_and_exceptions) {
+  {
+    btree_bimap<address_checking_object, int> a;
+    for (int i = 0; i < 1000; i++) {
+      a.insert(i, 1000 - i);
+    }
+    btree_bimap<address_checking_object, int> b = a;
+    EXPECT_EQ(a, b);
+    b.erase_left(5);
+    EXPECT_NE(a, b);
+
+    address_checking_object::set_copy_throw_countdown(2);
+    EXPECT_THROW(b.insert(5, 995), std::runtime_error);
+    EXPECT_EQ(b.find_right(995), b.end_right());
+    EXPECT_EQ(b.size(), 999);
+
+    btree_bimap<address_checking_object, int> c = std::move(a);
+    EXPECT_TRUE(a.empty());
+    a = c;
+    a.swap(b);
+    EXPECT_EQ(b, c);
+    EXPECT_EQ(a.size(), 999);
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(btree_bimap, pmr_allocation) {
+  counting_resource resource;
+  {
+    btree_bimap<int, int, std::less<int>, std::less<int>,
+                std::pmr::polymorphic_allocator<std::pair<int, int>>>
+        b(&resource);
+    EXPECT_EQ(resource.allocations(), 0);
+    for (int i = 0; i < 10000; i++) {
+      b.insert(i, -i);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+      b.erase_left(i);
+    }
+    EXPECT_EQ(b.at_left(9999), -9999);
+  }
+  EXPECT_EQ(resource.bytes_in_use(), 0);
+}
+
+TEST(bimap, order_statistics) {
+  std::vector<std::pair<int, int>> pairs;
+  for (int i = 0; i < 1000; i++) {
+    pairs.emplace_back(2 * i, -i);
+  }
+  bimap<int, int> built(pairs.begin(), pairs.end());
+  bimap<int, int> b = built;
+  for (int i = 1000; i < 2000; i++) {
+    b.insert(2 * i, -i);
+  }
+  for (int i = 0; i < 2000; i += 3) {
+    b.erase_left(2 * i);
+  }
+  std::vector<int> lefts(b.begin_left(), b.end_left());
+  std::vector<int> rights(b.begin_right(), b.end_right());
+  for (size_t k = 0; k < lefts.size(); k++) {
+    EXPECT_EQ(*b.nth_left(k), lefts[k]);
+    EXPECT_EQ(*b.nth_right(k), rights[k]);
+    EXPECT_EQ(b.rank_left(b.find_left(lefts[k])), k);
+    EXPECT_EQ(b.rank_right(b.find_right(rights[k])), k);
+  }
+  EXPECT_EQ(b.nth_left(lefts.size()), b.end_left());
+  EXPECT_EQ(b.rank_right(b.end_right()), b.size());
+  EXPECT_EQ(*built.nth_left(500), 1000);
+
+  EXPECT_EQ(b.count_range_left(0, 4000), b.size());
+  EXPECT_EQ(b.count_range_left(1001, 1002), 0);
+  EXPECT_EQ(b.count_range_left(100, 90), 0);
+  EXPECT_EQ(b.count_range_right(-1500, -1400),
+            std::count_if(rights.begin(), rights.end(),
+                          [](int x) { return -1500 <= x && x < -1400; }));
+
+  auto it = b.begin_left();
+  it += 100;
+  EXPECT_EQ(*it, lefts[100]);
+  it -= 40;
+  EXPECT_EQ(*it, lefts[60]);
+  EXPECT_EQ(it - b.begin_left(), 60);
+  it = b.end_left();
+  it -= 1;
+  EXPECT_EQ(*it, lefts.back());
+  it += 1;
+  EXPECT_EQ(it, b.end_left());
+}
+
+TEST(concurrent_bimap, simple) {
+  concurrent_bimap<int, std::string> b;
+  EXPECT_TRUE(b.insert(1, "one"));
+  EXPECT_TRUE(b.insert(2, "two"));
+  EXPECT_FALSE(b.insert(3, "one"));
+  EXPECT_EQ(b.find_left(2), "two");
+  EXPECT_EQ(b.find_right("one"), 1);
+  EXPECT_EQ(b.find_left(3), std::nullopt);
+  {
+    auto s = b.read();
+    EXPECT_EQ(s->size(), 2);
+    EXPECT_EQ(*s->begin_right(), "one");
+  }
+  EXPECT_TRUE(b.erase_right("one"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_EQ(b.modify([](auto& map) { return map.at_left_or_default(5); }),
+            "");
+  EXPECT_EQ(b.find_right(""), 5);
+  b.clear();
+  EXPECT_TRUE(b.read()->empty());
+}
+
+TEST(concurrent_bimap, readers_see_consistent_snapshots) {
+  // the writer keeps the pairs (i, -i) for i in a sliding window [lo, hi),
+  // so every snapshot must be one contiguous window
+  concurrent_bimap<int, int> b;
+  std::atomic<bool> done{false};
+  std::atomic<size_t> snapshots{0};
+  auto reader = [&] {
+    for (; !done.load(); std::this_thread::yield()) {
+      auto s = b.read();
+      if (s->empty()) {
+        continue;
+      }
+      int lo = *s->begin_left();
+      int expected = lo;
+      for (auto it = s->begin_left(); it != s->end_left(); ++it) {
+        ASSERT_EQ(*it, expected);
+        ASSERT_EQ(*it.flip(), -expected);
+        expected++;
+      }
+      ASSERT_EQ(expected - lo, s->size());
+      ASSERT_EQ(s->at_right(-lo), lo);
+      snapshots++;
+    }
+  };
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back(reader);
+  }
+  for (int i = 0; i < 20000; i++) {
+    b.insert(i, -i);
+    if (i >= 100) {
+      b.erase_left(i - 100);
+    }
+  }
+  while (snapshots.load() < 100) {
+    std::this_thread::yield();
+  }
+  done = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  EXPECT_EQ(b.read()->size(), 100);
+}
+
+TEST(sharded_bimap, simple) {
+  sharded_bimap<int, std::string> b(5);
+  EXPECT_EQ(b.shard_count(), 8);
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(1, "one"));
+  EXPECT_TRUE(b.insert(2, "two"));
+  EXPECT_FALSE(b.insert(1, "three"));
+  EXPECT_FALSE(b.insert(3, "two"));
+  EXPECT_EQ(b.at_left(1), "one");
+  EXPECT_EQ(b.at_right("two"), 2);
+  EXPECT_THROW(b.at_right("three"), std::out_of_range);
+  EXPECT_EQ(b.find_left(3), std::nullopt);
+  EXPECT_TRUE(b.erase_right("one"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_TRUE(b.insert(1, "three"));
+  EXPECT_EQ(b.size(), 2);
+}
+
+namespace {
+// keys equal modulo mod_; neither can be default-constructed
+struct modulo_hash {
+  explicit modulo_hash(int mod) : mod_(mod) {}
+
+  size_t operator()(int key) const {
+    return std::hash<int>()(key % mod_);
+  }
+
+  int mod_;
+};
+
+struct modulo_equal {
+  explicit modulo_equal(int mod) : mod_(mod) {}
+
+  bool operator()(int a, int b) const {
+    return a % mod_ == b % mod_;
+  }
+
+  int mod_;
+};
+} // namespace
+
+TEST(sharded_bimap, stateful_hash) {
+  sharded_bimap<int, int, modulo_hash, modulo_hash, modulo_equal,
+                modulo_equal>
+      b(4, modulo_hash(10), modulo_hash(1000), modulo_equal(10),
+        modulo_equal(1000));
+  EXPECT_TRUE(b.insert(3, 5));
+  EXPECT_FALSE(b.insert(13, 6));
+  EXPECT_FALSE(b.insert(4, 1005));
+  EXPECT_TRUE(b.insert(4, 6));
+  EXPECT_EQ(b.at_left(23), 5);
+  EXPECT_EQ(b.at_right(2005), 3);
+  EXPECT_TRUE(b.erase_left(33));
+  EXPECT_EQ(b.find_right(5), std::nullopt);
+  EXPECT_EQ(b.size(), 1);
+}
+
+TEST(sharded_bimap, concurrent_uniqueness) {
+  // every right key is fought for by all threads, exactly one must win
+  constexpr int threads = 4;
+  constexpr int keys = 20000;
+  sharded_bimap<int, int> b(16);
+  std::atomic<size_t> wins{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (int i = 0; i < keys; i++) {
+        if (b.insert(t * keys + i, i)) {
+          wins++;
+        }
+        if (i % 3 == 0) {
+          b.erase_right(i / 2);
+        }
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  size_t present = 0;
+  for (int i = 0; i < keys; i++) {
+    std::optional<int> left = b.find_right(i);
+    if (left) {
+      EXPECT_EQ(*left % keys, i);
+      EXPECT_EQ(b.at_left(*left), i);
+      present++;
+    }
+  }
+  EXPECT_EQ(b.size(), present);
+  EXPECT_GE(wins.load(), present);
+}
+
+TEST(persistent_bimap, versions) {
+  persistent_bimap<int, std::string> empty;
+  auto v1 = empty.insert(1, "one").insert(2, "two");
+  auto v2 = v1.insert(3, "three").erase_left(1);
+  auto v3 = v2.insert(4, "two");
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(v1.size(), 2);
+  EXPECT_EQ(v2.size(), 2);
+  EXPECT_EQ(v3, v2);
+  EXPECT_EQ(v1.at_left(1), "one");
+  EXPECT_EQ(v2.find_left(1), v2.end_left());
+  EXPECT_EQ(v2.at_right("three"), 3);
+  EXPECT_THROW(v1.at_right("three"), std::out_of_range);
+  EXPECT_EQ(*v2.find_right("two").flip(), 2);
+  EXPECT_EQ(*v2.lower_bound_left(0), 2);
+  EXPECT_EQ(v2.upper_bound_right("two"), v2.end_right());
+  EXPECT_EQ(*--v2.end_right(), "two");
+
+  std::vector<int> lefts(v2.begin_left(), v2.end_left());
+  EXPECT_EQ(lefts, (std::vector<int>{2, 3}));
+  auto v4 = v2.erase_right("two");
+  EXPECT_EQ(v4.size(), 1);
+  EXPECT_NE(v4, v2);
+  EXPECT_EQ(v2.size(), 2);
+}
+
+TEST(persistent_bimap, old_versions_stay_intact) {
+  {
+    std::vector<persistent_bimap<address_checking_object, int>> versions(1);
+    std::map<int, int> expected;
+    std::vector<std::map<int, int>> expected_versions(1);
+    std::mt19937 e;
+    for (int i = 0; i < 3000; i++) {
+      int l = static_cast<int>(e() % 500);
+      if (expected.count(l) != 0) {
+        versions.push_back(versions.back().erase_left(l));
+        expected.erase(l);
+      } else {
+        versions.push_back(versions.back().insert(l, -l));
+        expected[l] = -l;
+      }
+      expected_versions.push_back(expected);
+    }
+    for (size_t i = 0; i < versions.size(); i += 97) {
+      auto const& v = versions[i];
+      ASSERT_EQ(v.size(), expected_versions[i].size());
+      auto it = v.begin_left();
+      for (auto [l, r] : expected_versions[i]) {
+        ASSERT_EQ(*it, l);
+        ASSERT_EQ(*it.flip(), r);
+        ++it;
+      }
+      auto rit = v.end_right();
+      for (auto [l, r] : expected_versions[i]) {
+        ASSERT_EQ(*--rit, r);
+      }
+    }
+    versions.erase(versions.begin(), versions.end() - 1);
+    EXPECT_EQ(versions.back().size(), expected.size());
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(flat_bimap, matches_bimap_range_constructor) {
+  std::mt19937 e;
+  std::vector<std::pair<int, std::string>> pairs;
+  for (int i = 0; i < 3000; i++) {
+    pairs.emplace_back(static_cast<int>(e() % 2000), std::to_string(e() % 2000));
+  }
+  bimap<int, std::string> b(pairs.begin(), pairs.end());
+  flat_bimap<int, std::string> f(pairs.begin(), pairs.end());
+  ASSERT_EQ(f.size(), b.size());
+  auto it = f.begin_left();
+  for (auto bit = b.begin_left(); bit != b.end_left(); ++bit, ++it) {
+    ASSERT_EQ(*it, *bit);
+    ASSERT_EQ(*it.flip(), *bit.flip());
+    ASSERT_EQ(it.flip().flip(), it);
+  }
+  auto rit = f.begin_right();
+  for (auto bit = b.begin_right(); bit != b.end_right(); ++bit, ++rit) {
+    ASSERT_EQ(*rit, *bit);
+    ASSERT_EQ(*rit.flip(), *bit.flip());
+  }
+  EXPECT_EQ(rit, f.end_right());
+  EXPECT_EQ(f.end_left().flip(), f.end_right());
+
+  for (int i = 0; i < 2500; i++) {
+    int l = static_cast<int>(e() % 2100) - 50;
+    std::string r = std::to_string(static_cast<int>(e() % 2100) - 50);
+    ASSERT_EQ(f.lower_bound_left(l) - f.begin_left(),
+              b.rank_left(b.lower_bound_left(l)));
+    ASSERT_EQ(f.upper_bound_left(l) - f.begin_left(),
+              b.rank_left(b.upper_bound_left(l)));
+    ASSERT_EQ(f.lower_bound_right(r) - f.begin_right(),
+              b.rank_right(b.lower_bound_right(r)));
+    ASSERT_EQ(f.upper_bound_right(r) - f.begin_right(),
+              b.rank_right(b.upper_bound_right(r)));
+    auto found = f.find_right(r);
+    ASSERT_EQ(found == f.end_right(), b.find_right(r) == b.end_right());
+    if (found != f.end_right()) {
+      ASSERT_EQ(f.at_right(r), b.at_right(r));
+    }
+  }
+  flat_bimap<int, std::string> from_bimap(b);
+  EXPECT_EQ(from_bimap, f);
+}
+
+namespace {
+// ascending by default, so a default-constructed one is the wrong order
+struct int_order {
+  explicit int_order(bool descending = false) : descending_(descending) {}
+
+  bool operator()(int a, int b) const {
+    return descending_ ? b < a : a < b;
+  }
+
+  bool descending_;
+};
+} // namespace
+
+TEST(flat_bimap, keeps_comparators) {
+  bimap<int, int, int_order, int_order> b(int_order(true), int_order(true));
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, 3 * i);
+  }
+  flat_bimap<int, int, int_order, int_order> f(b);
+  EXPECT_EQ(*f.begin_left(), 99);
+  EXPECT_EQ(*f.begin_right(), 297);
+  EXPECT_EQ(f.at_left(10), 30);
+  EXPECT_EQ(f.at_right(30), 10);
+  flat_bimap<int, int, int_order, int_order> ascending(b, int_order(),
+                                                        int_order());
+  EXPECT_EQ(*ascending.begin_left(), 0);
+  EXPECT_EQ(ascending.at_right(30), 10);
+}
+
+TEST(flat_bimap, copy_move_swap) {
+  flat_bimap<int, int> a{{1, 10}, {2, 20}, {3, 30}};
+  flat_bimap<int, int> b{{5, 50}};
+  flat_bimap<int, int> c = a;
+  EXPECT_EQ(c, a);
+  EXPECT_EQ(c.at_right(20), 2);
+  c = b;
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(c.at_left(5), 50);
+  swap(a, c);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(c.at_right(30), 3);
+  flat_bimap<int, int> d = std::move(c);
+  EXPECT_TRUE(c.empty());
+  EXPECT_EQ(c.find_left(1), c.end_left());
+  EXPECT_EQ(*d.begin_right().flip(), 1);
+  d = std::move(a);
+  EXPECT_EQ(d, b);
+  EXPECT_EQ(d.at_left(5), 50);
+  std::vector<std::tuple<int, int>> same_right{{7, 1}, {8, 1}};
+  d.assign(same_right.begin(), same_right.end());
+  EXPECT_EQ(d.size(), 1);
+  EXPECT_EQ(d.at_right(1), 7);
+  flat_bimap<int, int> empty;
+  EXPECT_EQ(empty.lower_bound_left(3), empty.end_left());
+  EXPECT_THROW(empty.at_left(3), std::out_of_range);
+}
+
+#if BIMAP_TEST_MAPPED
+namespace {
+std::string temp_file(char const* name) {
+  return (std::filesystem::temp_directory_path() /
+          (name + std::to_string(::getpid())))
+      .string();
+}
+} // namespace
+
+TEST(mapped_bimap, matches_bimap) {
+  bimap<int, int64_t> b;
+  std::mt19937 e;
+  for (int i = 0; i < 5000; i++) {
+    b.insert(static_cast<int>(e() % 20000), static_cast<int64_t>(e()));
+  }
+  std::string path = temp_file("bimap_mapped_");
+  mapped_bimap<int, int64_t>::write(b, path);
+  {
+    mapped_bimap<int, int64_t> m(path);
+    ASSERT_EQ(m.size(), b.size());
+    auto it = m.begin_left();
+    for (auto bit = b.begin_left(); bit != b.end_left(); ++bit, ++it) {
+      ASSERT_EQ(*it, *bit);
+      ASSERT_EQ(*it.flip(), *bit.flip());
+      ASSERT_EQ(it.flip().flip(), it);
+    }
+    EXPECT_EQ(it, m.end_left());
+    auto rit = m.begin_right();
+    for (auto bit = b.begin_right(); bit != b.end_right(); ++bit, ++rit) {
+      ASSERT_EQ(*rit, *bit);
+      ASSERT_EQ(*rit.flip(), *bit.flip());
+    }
+    EXPECT_EQ(m.end_right().flip(), m.end_left());
+
+    for (int i = 0; i < 1000; i++) {
+      int l = static_cast<int>(e() % 20000);
+      auto found = m.find_left(l);
+      ASSERT_EQ(found == m.end_left(), b.find_left(l) == b.end_left());
+      if (found != m.end_left()) {
+        ASSERT_EQ(m.at_left(l), b.at_left(l));
+        ASSERT_EQ(m.at_right(*found.flip()), l);
+      } else {
+        EXPECT_THROW(m.at_left(l), std::out_of_range);
+      }
+      ASSERT_EQ(m.lower_bound_left(l) - m.begin_left(),
+                b.rank_left(b.lower_bound_left(l)));
+      ASSERT_EQ(m.upper_bound_left(l) - m.begin_left(),
+                b.rank_left(b.upper_bound_left(l)));
+      auto r = static_cast<int64_t>(e());
+      ASSERT_EQ(m.lower_bound_right(r) - m.begin_right(),
+                b.rank_right(b.lower_bound_right(r)));
+      ASSERT_EQ(m.upper_bound_right(r) - m.begin_right(),
+                b.rank_right(b.upper_bound_right(r)));
+    }
+
+    mapped_bimap<int, int64_t> moved(std::move(m));
+    EXPECT_EQ(moved.size(), b.size());
+    EXPECT_TRUE(m.empty());
+    auto& self = moved;
+    moved = std::move(self);
+    EXPECT_EQ(moved.size(), b.size());
+    EXPECT_EQ(moved.at_left(*b.begin_left()), *b.begin_left().flip());
+    m = std::move(moved);
+    EXPECT_EQ(m.size(), b.size());
+    EXPECT_TRUE(moved.empty());
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(mapped_bimap, rejects_foreign_files) {
+  std::string path = temp_file("bimap_mapped_foreign_");
+  using int_types = mapped_bimap<int, int>;
+  EXPECT_THROW(int_types{path}, std::system_error);
+  bimap<char, int64_t> b;
+  b.insert('a', 1);
+  b.insert('b', -1);
+  mapped_bimap<char, int64_t>::write(b, path);
+  {
+    mapped_bimap<char, int64_t> m(path);
+    EXPECT_EQ(m.at_right(-1), 'b');
+    EXPECT_EQ(*m.begin_right().flip(), 'b');
+  }
+  using wrong_types = mapped_bimap<int, int64_t>;
+  EXPECT_THROW(wrong_types{path}, std::runtime_error);
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << "tail";
+  }
+  using right_types = mapped_bimap<char, int64_t>;
+  EXPECT_THROW(right_types{path}, std::runtime_error);
+  std::filesystem::remove(path);
+}
+
+TEST(mapped_bimap, keeps_comparators) {
+  using descending = int_order;
+  bimap<int, int, descending, descending> b(descending(true),
+                                            descending(true));
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, 3 * i);
+  }
+  EXPECT_TRUE(b.left_comparator().descending_);
+  std::string path = temp_file("bimap_mapped_comparators_");
+  mapped_bimap<int, int, descending, descending>::write(b, path);
+  {
+    mapped_bimap<int, int, descending, descending> m(path, descending(true),
+                                                     descending(true));
+    EXPECT_EQ(*m.begin_left(), 99);
+    EXPECT_EQ(*m.begin_right(), 297);
+    EXPECT_EQ(m.at_left(10), 30);
+    EXPECT_EQ(m.at_right(30), 10);
+  }
+  std::filesystem::remove(path);
+}
+#endif
+
+namespace {
+enum class color { red, green, blue, black };
+
+constexpr auto color_names = make_static_bimap<color, std::string_view>(
+    {{color::blue, "blue"},
+     {color::red, "red"},
+     {color::black, "black"},
+     {color::green, "green"}});
+
+static_assert(color_names.at_left(color::green) == "green");
+static_assert(color_names.at_right("black") == color::black);
+static_assert(color_names.find_right("white") == nullptr);
+static_assert(color_names.size() == 4);
+} // namespace
+
+TEST(static_bimap, lookups) {
+  for (auto [c, name] : {std::pair{color::red, "red"},
+                         std::pair{color::green, "green"},
+                         std::pair{color::blue, "blue"},
+                         std::pair{color::black, "black"}}) {
+    ASSERT_NE(color_names.find_left(c), nullptr);
+    EXPECT_EQ(*color_names.find_left(c), name);
+    EXPECT_EQ(color_names.at_right(std::string(name)), c);
+  }
+  EXPECT_FALSE(color_names.contains_right("white"));
+  EXPECT_THROW(color_names.at_right("white"), std::out_of_range);
+  EXPECT_TRUE(std::is_sorted(color_names.lefts().begin(),
+                             color_names.lefts().end()));
+  EXPECT_EQ(color_names.rights()[0], "red");
+
+  std::mt19937 e;
+  std::vector<int> values(64);
+  std::iota(values.begin(), values.end(), 0);
+  std::shuffle(values.begin(), values.end(), e);
+  std::pair<int, int> pairs[64];
+  for (int i = 0; i < 64; i++) {
+    pairs[i] = {values[i], -i};
+  }
+  static_bimap<int, int, 64, std::greater<int>> b(pairs);
+  for (int i = 0; i < 64; i++) {
+    EXPECT_EQ(b.at_left(values[i]), -i);
+    EXPECT_EQ(b.at_right(-i), values[i]);
+  }
+  EXPECT_EQ(b.lefts()[0], 63);
+  EXPECT_EQ(b.find_left(64), nullptr);
+  EXPECT_EQ(b.find_right(1), nullptr);
+}
+
+TEST(static_bimap, rejects_duplicates) {
+  using int_types = static_bimap<int, int, 3>;
+  std::pair<int, int> same_left[] = {{1, 1}, {2, 2}, {1, 3}};
+  std::pair<int, int> same_right[] = {{1, 1}, {2, 2}, {3, 1}};
+  EXPECT_THROW(int_types{same_left}, std::invalid_argument);
+  EXPECT_THROW(int_types{same_right}, std::invalid_argument);
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T>& lefts, std::vector<T>& rights, std::mt19937& e) {
@@ -589,3 +1877,746 @@ TEST(bimap_randomized, compare_to_two_maps) {
   std::cout << "Performed " << ins << " insertions and " << total - ins - skip
             << " erasures. " << skip << " skipped." << std::endl;
 }
+
+namespace {
+using int_node = nodes::node<int, int>;
+
+struct int_left_getter {
+  static int const& get(nodes::tree_node* ptr) {
+    return nodes::casts::tree_to_node<int, int, nodes::left_tag>(ptr)
+        ->l_element;
+  }
+};
+
+using int_tree = bimap_tree::tree<int, std::less<int>, int_left_getter>;
+
+nodes::tree_node* as_left(int_node* ptr) {
+  return nodes::casts::node_to_tree<int, int, nodes::left_tag>(ptr);
+}
+
+size_t tree_height(nodes::tree_node* ptr) {
+  if (ptr == nullptr) {
+    return 0;
+  }
+  return 1 + std::max(tree_height(ptr->left_), tree_height(ptr->right_));
+}
+
+// Returns the black height of the subtree or -1 if a red-black invariant is
+// broken somewhere inside it.
+int black_height(nodes::tree_node* ptr) {
+  if (ptr == nullptr) {
+    return 1;
+  }
+  for (nodes::tree_node* child : {ptr->left_, ptr->right_}) {
+    if (child != nullptr &&
+        (child->parent() != ptr || (ptr->red() && child->red()))) {
+      return -1;
+    }
+  }
+  int l = black_height(ptr->left_);
+  int r = black_height(ptr->right_);
+  if (l == -1 || l != r) {
+    return -1;
+  }
+  return l + (ptr->red() ? 0 : 1);
+}
+} // namespace
+
+TEST(bimap_tree, sorted_insert_height) {
+  constexpr int total = 10'000'000;
+  nodes::base_node fake;
+  int_tree tree(std::less<int>(),
+                nodes::casts::base_to_tree<nodes::left_tag>(&fake));
+  std::vector<int_node> storage;
+  storage.reserve(total);
+  for (int i = 0; i < total; i++) {
+    storage.emplace_back(i, i);
+    tree.insert(as_left(&storage.back()));
+  }
+  nodes::tree_node* root = tree.fake_->left_;
+  EXPECT_FALSE(root->red());
+  EXPECT_NE(black_height(root), -1);
+  // a red-black tree with n nodes is at most 2 * log2(n + 1) high
+  EXPECT_LE(tree_height(root), 2 * std::log2(total + 1));
+  EXPECT_EQ(int_left_getter::get(tree.fake_->minimum()), 0);
+  EXPECT_EQ(int_left_getter::get(tree.fake_->prev()), total - 1);
+}
+
+TEST(bimap_tree, build) {
+  std::vector<int_node> storage;
+  storage.reserve(300);
+  std::vector<nodes::tree_node*> sorted;
+  for (int i = 0; i < 300; i++) {
+    storage.emplace_back(i, i);
+    sorted.push_back(as_left(&storage.back()));
+  }
+  for (size_t size = 0; size <= sorted.size(); size++) {
+    nodes::base_node fake;
+    int_tree tree(std::less<int>(),
+                  nodes::casts::base_to_tree<nodes::left_tag>(&fake));
+    for (size_t i = 0; i < size; i++) {
+      *sorted[i] = nodes::tree_node();
+    }
+    tree.build(sorted.begin(), size, [](nodes::tree_node* ptr) { return ptr; });
+    nodes::tree_node* root = tree.fake_->left_;
+    ASSERT_NE(black_height(root), -1);
+    ASSERT_TRUE(root == nullptr || !root->red());
+    ASSERT_EQ(tree.fake_->right_, size == 0 ? nullptr : sorted[size - 1]);
+    int expected = 0;
+    for (nodes::tree_node* it = tree.fake_->minimum(); it != tree.fake_;
+         it = it->next()) {
+      ASSERT_EQ(int_left_getter::get(it), expected++);
+    }
+    ASSERT_EQ(expected, size);
+  }
+}
+
+TEST(bimap_tree, randomized_invariants) {
+  constexpr int total = 20000;
+  nodes::base_node fake;
+  int_tree tree(std::less<int>(),
+                nodes::casts::base_to_tree<nodes::left_tag>(&fake));
+  std::vector<int_node> storage;
+  storage.reserve(total);
+  for (int i = 0; i < total; i++) {
+    storage.emplace_back(i, i);
+  }
+
+  std::mt19937 e(seed);
+  std::set<int> present;
+  for (int i = 0; i < 4 * total; i++) {
+    int key = static_cast<int>(e() % total);
+    if (present.count(key) == 0) {
+      tree.insert(as_left(&storage[key]));
+      present.insert(key);
+    } else {
+      tree.erase(as_left(&storage[key]));
+      present.erase(key);
+    }
+    if (i % 1000 == 0) {
+      nodes::tree_node* root = tree.fake_->left_;
+      ASSERT_NE(black_height(root), -1);
+      ASSERT_TRUE(root == nullptr || !root->red());
+      std::vector<int> keys;
+      for (nodes::tree_node* it = tree.fake_->minimum(); it != tree.fake_;
+           it = it->next()) {
+        ASSERT_EQ(it->rank(), keys.size());
+        ASSERT_EQ(tree.fake_->select(keys.size()), it);
+        keys.push_back(int_left_getter::get(it));
+      }
+      ASSERT_EQ(tree.fake_->rank(), keys.size());
+      ASSERT_TRUE(std::equal(keys.begin(), keys.end(), present.begin(),
+                             present.end()));
+      nodes::tree_node* max =
+          present.empty() ? nullptr : as_left(&storage[*present.rbegin()]);
+      ASSERT_EQ(tree.fake_->right_, max);
+    }
+  }
+}
+
+namespace {
+struct string_hash {
+  using is_transparent = void;
+
+  size_t operator()(std::string_view str) const {
+    return std::hash<std::string_view>()(str);
+  }
+};
+
+struct address_hash {
+  size_t operator()(address_checking_object const& obj) const {
+    return std::hash<int>()(obj);
+  }
+};
+
+using address_unordered_bimap =
+    unordered_bimap<address_checking_object, int, address_hash>;
+} // namespace
+
+TEST(unordered_bimap, simple) {
+  unordered_bimap<int, int> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  b.insert(4, 3);
+  b.insert(1, 2);
+  EXPECT_EQ(b.insert(4, 10), b.end_left());
+  EXPECT_EQ(b.insert(10, 2), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(4), 3);
+  EXPECT_EQ(b.at_right(2), 1);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  EXPECT_EQ(*b.find_right(3).flip(), 4);
+  EXPECT_EQ(b.find_left(100), b.end_left());
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+
+  // both sides are iterated in insertion order
+  std::vector<int> lefts(b.begin_left(), b.end_left());
+  std::vector<int> rights(b.begin_right(), b.end_right());
+  EXPECT_EQ(lefts, (std::vector<int>{4, 1}));
+  EXPECT_EQ(rights, (std::vector<int>{3, 2}));
+  EXPECT_EQ(*--b.end_left(), 1);
+
+  EXPECT_TRUE(b.erase_left(4));
+  EXPECT_FALSE(b.erase_right(3));
+  EXPECT_EQ(*b.erase_right(b.begin_right()).flip(), *b.end_left());
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(unordered_bimap, at_or_default) {
+  unordered_bimap<int, int> b;
+  b.insert(4, 2);
+  EXPECT_EQ(b.at_left_or_default(4), 2);
+  EXPECT_EQ(b.at_left_or_default(5), 0);
+  EXPECT_EQ(b.at_right(0), 5);
+  EXPECT_EQ(b.at_left_or_default(42), 0);
+  EXPECT_EQ(b.at_right(0), 42);
+  EXPECT_EQ(b.find_left(5), b.end_left());
+
+  EXPECT_EQ(b.at_right_or_default(1), 0);
+  EXPECT_EQ(b.at_right_or_default(1000), 0);
+  EXPECT_EQ(b.at_left(0), 1000);
+  EXPECT_EQ(b.find_right(1), b.end_right());
+  EXPECT_EQ(b.size(), 3);
+}
+
+TEST(unordered_bimap, heterogeneous_lookup) {
+  unordered_bimap<std::string, std::string, string_hash, string_hash,
+                  std::equal_to<>, std::equal_to<>>
+      b;
+  b.insert("apple", "red");
+  b.insert("banana", "yellow");
+  EXPECT_EQ(b.at_left(std::string_view("apple")), "red");
+  EXPECT_EQ(b.at_right(std::string_view("yellow")), "banana");
+  EXPECT_EQ(b.find_left(std::string_view("kiwi")), b.end_left());
+  EXPECT_TRUE(b.erase_right(std::string_view("red")));
+  EXPECT_EQ(b.size(), 1);
+}
+
+TEST(unordered_bimap, copy_move_swap) {
+  {
+    address_unordered_bimap a;
+    for (int i = 0; i < 100; i++) {
+      a.insert(i, 1000 + i);
+    }
+    address_unordered_bimap b = a;
+    EXPECT_EQ(a, b);
+    b.erase_left(5);
+    EXPECT_NE(a, b);
+    b.insert(5, 1005);
+    EXPECT_EQ(a, b);
+
+    address_unordered_bimap c = std::move(a);
+    EXPECT_TRUE(a.empty());
+    EXPECT_EQ(c, b);
+    a.insert(1, 1);
+    a.swap(c);
+    EXPECT_EQ(a.size(), 100);
+    EXPECT_EQ(c.at_right(1), 1);
+    c = a;
+    EXPECT_EQ(c, a);
+    c = std::move(a);
+    EXPECT_EQ(c.at_left(99), 1099);
+
+    address_checking_object::set_copy_throw_countdown(50);
+    EXPECT_THROW(address_unordered_bimap{c}, std::runtime_error);
+    EXPECT_EQ(c.size(), 100);
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(unordered_bimap, pmr_allocation) {
+  counting_resource resource;
+  {
+    unordered_bimap<int, int, std::hash<int>, std::hash<int>,
+                    std::equal_to<int>, std::equal_to<int>,
+                    std::pmr::polymorphic_allocator<std::pair<int, int>>>
+        b(&resource);
+    EXPECT_EQ(resource.allocations(), 0);
+    b.reserve(1000);
+    for (int i = 0; i < 1000; i++) {
+      b.insert(i, -i);
+    }
+    EXPECT_EQ(b.at_right(-500), 500);
+  }
+  EXPECT_EQ(resource.bytes_in_use(), 0);
+}
+
+TEST(unordered_bimap, compare_to_two_maps) {
+  unordered_bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 60000; i++) {
+    int l = static_cast<int>(e() % 5000);
+    int r = static_cast<int>(e() % 5000);
+    if (e() % 3 != 0) {
+      bool inserted = b.insert(l, r) != b.end_left();
+      EXPECT_EQ(inserted,
+                left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (left_view.count(l) != 0) {
+      EXPECT_TRUE(b.erase_left(l));
+      right_view.erase(left_view[l]);
+      left_view.erase(l);
+    } else {
+      EXPECT_FALSE(b.erase_left(l));
+    }
+    if (i % 1000 == 0) {
+      ASSERT_EQ(b.size(), left_view.size());
+      for (auto [key, value] : left_view) {
+        ASSERT_EQ(b.at_left(key), value);
+        ASSERT_EQ(b.at_right(value), key);
+      }
+    }
+  }
+}
+
+TEST(bimap, clear) {
+  {
+    bimap<address_checking_object, std::string> b;
+    for (int round = 0; round < 3; round++) {
+      for (int i = 0; i < 1000; i++) {
+        b.insert(i * 7 % 1000, std::to_string(i + round));
+      }
+      EXPECT_EQ(b.size(), 1000);
+      b.clear();
+      EXPECT_TRUE(b.empty());
+      EXPECT_EQ(b.begin_left(), b.end_left());
+      EXPECT_EQ(b.begin_right(), b.end_right());
+      EXPECT_EQ(b.find_left(5), b.end_left());
+      address_checking_object::expect_no_instances();
+    }
+    b.insert(1, "1");
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(bimap, erase_long_ranges) {
+  {
+    bimap<address_checking_object, int> b;
+    std::map<int, int> left_view, right_view;
+    std::mt19937 e(seed);
+    for (int round = 0; round < 200; round++) {
+      for (int i = 0; i < 300; i++) {
+        int l = static_cast<int>(e() % 2000);
+        int r = static_cast<int>(e() % 2000);
+        if (b.insert(l, r) != b.end_left()) {
+          left_view[l] = r;
+          right_view[r] = l;
+        }
+      }
+      int from = static_cast<int>(e() % 2000);
+      int to = from + static_cast<int>(e() % (round % 4 == 0 ? 50 : 1500));
+      if (round % 2 == 0) {
+        auto it = b.erase_left(b.lower_bound_left(from), b.lower_bound_left(to));
+        EXPECT_EQ(it, b.lower_bound_left(to));
+        for (auto i = left_view.lower_bound(from);
+             i != left_view.lower_bound(to);) {
+          right_view.erase(i->second);
+          i = left_view.erase(i);
+        }
+      } else {
+        auto it =
+            b.erase_right(b.lower_bound_right(from), b.lower_bound_right(to));
+        EXPECT_EQ(it, b.lower_bound_right(to));
+        for (auto i = right_view.lower_bound(from);
+             i != right_view.lower_bound(to);) {
+          left_view.erase(i->second);
+          i = right_view.erase(i);
+        }
+      }
+      ASSERT_EQ(b.size(), left_view.size());
+      size_t k = 0;
+      auto it = b.begin_left();
+      for (auto [l, r] : left_view) {
+        ASSERT_EQ(*it, l);
+        ASSERT_EQ(*it.flip(), r);
+        ASSERT_EQ(b.rank_left(it), k);
+        ASSERT_EQ(b.nth_left(k++), it);
+        ++it;
+      }
+      k = 0;
+      auto rit = b.begin_right();
+      for (auto [r, l] : right_view) {
+        ASSERT_EQ(*rit, r);
+        ASSERT_EQ(b.rank_right(rit), k++);
+        ++rit;
+      }
+    }
+    b.erase_right(b.begin_right(), b.end_right());
+    EXPECT_TRUE(b.empty());
+  }
+  address_checking_object::expect_no_instances();
+}
+
+TEST(bimap, replace) {
+  bimap<int, int, counting_less, counting_less> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(10 * i, i);
+  }
+  // a key between the neighbours keeps the node in place
+  auto it = b.find_left(500);
+  auto rit = it.flip();
+  counting_less::calls = 0;
+  EXPECT_EQ(b.replace_left(it, 505), it);
+  EXPECT_LE(counting_less::calls, 2);
+  EXPECT_EQ(*it, 505);
+  EXPECT_EQ(*rit, 50);
+  EXPECT_EQ(rit.flip(), it);
+
+  // a key elsewhere moves the node on its side only
+  EXPECT_EQ(b.replace_left(it, -5), it);
+  EXPECT_EQ(b.begin_left(), it);
+  EXPECT_EQ(*b.find_right(50).flip(), -5);
+  EXPECT_EQ(b.find_left(505), b.end_left());
+
+  // keys of other pairs are rejected
+  EXPECT_EQ(b.replace_left(it, 10), b.end_left());
+  EXPECT_EQ(*it, -5);
+  EXPECT_EQ(b.replace_right(rit, 7), b.end_right());
+  EXPECT_EQ(b.replace_right(rit, 50), rit);
+  EXPECT_EQ(b.replace_right(rit, 1000), rit);
+  EXPECT_EQ(std::prev(b.end_right()), rit);
+  EXPECT_EQ(b.at_left(-5), 1000);
+  EXPECT_EQ(b.size(), 100);
+}
+
+namespace {
+// throws at the countdown-th comparison from now, if set
+struct throwing_less {
+  static inline int countdown = -1;
+
+  bool operator()(int a, int b) const {
+    if (countdown >= 0 && countdown-- == 0) {
+      throw std::runtime_error("comparison failed");
+    }
+    return a < b;
+  }
+};
+} // namespace
+
+TEST(bimap, throwing_in_replace) {
+  using throwing_bimap = bimap<int, int, throwing_less, throwing_less>;
+  throwing_bimap b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(10 * i, i);
+  }
+  auto it = b.find_left(500);
+  bool thrown = true;
+  for (int countdown = 0; thrown; countdown++) {
+    throwing_less::countdown = countdown;
+    try {
+      b.replace_left(it, -5);
+      thrown = false;
+    } catch (std::runtime_error const& error) {
+      // nothing has changed
+      throwing_less::countdown = -1;
+      EXPECT_EQ(*it, 500);
+      EXPECT_EQ(b.find_left(500), it);
+    }
+    throwing_less::countdown = -1;
+    ASSERT_EQ(b.size(), 100);
+    ASSERT_EQ(std::distance(b.begin_left(), b.end_left()), 100);
+    ASSERT_TRUE(std::is_sorted(b.begin_left(), b.end_left()));
+    for (auto l = b.begin_left(); l != b.end_left(); ++l) {
+      ASSERT_EQ(l.flip().flip(), l);
+      ASSERT_EQ(b.find_left(*l), l);
+    }
+  }
+  EXPECT_EQ(b.begin_left(), it);
+  EXPECT_EQ(b.at_right(50), -5);
+}
+
+TEST(bimap, replace_randomized) {
+  bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 1000; i++) {
+    int l = static_cast<int>(e() % 3000);
+    int r = static_cast<int>(e() % 3000);
+    if (b.insert(l, r) != b.end_left()) {
+      left_view[l] = r;
+      right_view[r] = l;
+    }
+  }
+  for (int i = 0; i < 20000; i++) {
+    int key = static_cast<int>(e() % 3000);
+    int pos = static_cast<int>(e() % b.size());
+    // small changes mostly keep the position, big ones move the node
+    if (i % 3 == 0) {
+      key = *b.nth_left(pos) + static_cast<int>(e() % 5) - 2;
+    }
+    if (e() % 2 == 0) {
+      auto it = b.nth_left(pos);
+      int old = *it;
+      bool taken = old != key && left_view.count(key) != 0;
+      EXPECT_EQ(b.replace_left(it, key), taken ? b.end_left() : it);
+      if (!taken) {
+        int r = left_view[old];
+        left_view.erase(old);
+        left_view[key] = r;
+        right_view[r] = key;
+      }
+    } else {
+      auto it = b.nth_right(pos);
+      int old = *it;
+      bool taken = old != key && right_view.count(key) != 0;
+      EXPECT_EQ(b.replace_right(it, key), taken ? b.end_right() : it);
+      if (!taken) {
+        int l = right_view[old];
+        right_view.erase(old);
+        right_view[key] = l;
+        left_view[l] = key;
+      }
+    }
+  }
+  ASSERT_EQ(b.size(), left_view.size());
+  size_t k = 0;
+  auto it = b.begin_left();
+  for (auto [l, r] : left_view) {
+    ASSERT_EQ(*it, l);
+    ASSERT_EQ(*it.flip(), r);
+    ASSERT_EQ(b.nth_left(k++), it);
+    ++it;
+  }
+  k = 0;
+  auto rit = b.begin_right();
+  for (auto [r, l] : right_view) {
+    ASSERT_EQ(*rit, r);
+    ASSERT_EQ(*rit.flip(), l);
+    ASSERT_EQ(b.nth_right(k++), rit);
+    ++rit;
+  }
+}
+
+TEST(bimap, stats) {
+  bimap<int, int64_t> b;
+  auto empty = b.stats();
+  EXPECT_EQ(empty.left_.height_, 0);
+  EXPECT_EQ(empty.right_.average_depth_, 0);
+  EXPECT_EQ(empty.memory_, 0);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, -i);
+  }
+  auto s = b.stats();
+  // sorted insertions leave a red-black tree at most 2 * log2(n + 1) high
+  for (auto const& side : {s.left_, s.right_}) {
+    EXPECT_GE(side.height_, 10);
+    EXPECT_LE(side.height_, 2 * std::log2(1001));
+    EXPECT_GE(side.average_depth_, 8);
+    EXPECT_LE(side.average_depth_, side.height_);
+  }
+  EXPECT_EQ(s.left_.node_bytes_, 1000 * (sizeof(nodes::tree_node) + 4));
+  EXPECT_EQ(s.right_.node_bytes_, 1000 * (sizeof(nodes::tree_node) + 8));
+  EXPECT_GE(s.memory_, 1000 * sizeof(nodes::node<int, int64_t>));
+  // nothing is counted without an instrumentation policy
+  EXPECT_EQ(s.inserts_, 0);
+  EXPECT_EQ(s.left_.comparisons_, 0);
+}
+
+namespace {
+using counting_bimap =
+    bimap<int, int64_t, std::less<int>, std::less<int64_t>,
+          std::allocator<std::pair<int, int64_t>>,
+          bimap_instrumentation::counting>;
+} // namespace
+
+TEST(bimap, instrumentation) {
+  counting_bimap b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, -i);
+  }
+  auto s = b.stats();
+  EXPECT_EQ(s.inserts_, 1000);
+  EXPECT_EQ(s.allocations_, 1000);
+  EXPECT_EQ(s.erases_, 0);
+  size_t comparisons = s.left_.comparisons_;
+  size_t lookups = s.left_.lookups_;
+  size_t visits = s.left_.visits_;
+  size_t right_lookups = s.right_.lookups_;
+  EXPECT_NE(b.find_left(500), b.end_left());
+  b.erase_left(b.begin_left(), b.find_left(100));
+  b.erase_right(-999);
+  s = b.stats();
+  EXPECT_EQ(s.finds_, 3);
+  EXPECT_EQ(s.erases_, 101);
+  EXPECT_EQ(s.left_.lookups_, lookups + 2);
+  EXPECT_GT(s.left_.visits_, visits);
+  EXPECT_LE(s.left_.visits_, visits + 2 * 20);
+  EXPECT_GT(s.left_.comparisons_, comparisons);
+  EXPECT_EQ(s.right_.lookups_, right_lookups + 1);
+
+  // a copy counts its own operations, starting with its nodes
+  counting_bimap copy = b;
+  EXPECT_EQ(copy.stats().allocations_, copy.size());
+  EXPECT_EQ(copy.stats().finds_, 0);
+}
+
+TEST(bimap, instrumentation_concurrent_lookups) {
+  counting_bimap b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, -i);
+  }
+  counting_bimap const& readers = b;
+  size_t lookups = b.stats().left_.lookups_;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&readers] {
+      for (int i = 0; i < 10000; i++) {
+        EXPECT_EQ(readers.at_left(i % 1000), -(i % 1000));
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  auto s = b.stats();
+  EXPECT_EQ(s.finds_, 40000);
+  EXPECT_EQ(s.left_.lookups_, lookups + 40000);
+}
+
+TEST(bimap, instrumentation_costs_nothing_when_off) {
+  using tree_t = bimap_tree::tree<int, std::less<int>, nodes::left_tag>;
+  using counting_tree_t = bimap_tree::tree<int, std::less<int>, nodes::left_tag,
+                                           bimap_instrumentation::counting>;
+  EXPECT_EQ(sizeof(tree_t), sizeof(nodes::tree_node*));
+  EXPECT_GT(sizeof(counting_tree_t), sizeof(tree_t));
+  EXPECT_LT(sizeof(bimap<int, int64_t>), sizeof(counting_bimap));
+}
+
+TEST(bimap, set_operations) {
+  // yesterday's and today's mappings: some pairs dropped, some re-keyed,
+  // some added; big enough to be split between threads
+  bimap<int, int> a;
+  std::map<int, int> a_pairs;
+  std::mt19937 e(seed);
+  while (a.size() < 40000) {
+    int l = static_cast<int>(e() % 100000);
+    int r = static_cast<int>(e() % 100000);
+    if (a.insert(l, r) != a.end_left()) {
+      a_pairs[l] = r;
+    }
+  }
+  bimap<int, int> b = a;
+  for (int i = 0; i < 5000; i++) {
+    b.erase_left(b.nth_left(e() % b.size()));
+    b.replace_right(b.nth_right(e() % b.size()),
+                    static_cast<int>(e() % 200000));
+    b.insert(static_cast<int>(e() % 100000), static_cast<int>(e() % 200000));
+  }
+  std::map<int, int> b_pairs;
+  std::set<int> a_rights;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    b_pairs[*it] = *it.flip();
+  }
+  for (auto [l, r] : a_pairs) {
+    a_rights.insert(r);
+  }
+
+  std::map<int, int> expected_union = a_pairs;
+  std::map<int, int> expected_intersection;
+  std::map<int, int> expected_difference;
+  std::vector<std::pair<int, int>> added;
+  std::vector<std::tuple<int, int, int>> changed;
+  for (auto [l, r] : b_pairs) {
+    auto it = a_pairs.find(l);
+    if (it == a_pairs.end()) {
+      added.emplace_back(l, r);
+      if (a_rights.count(r) == 0) {
+        expected_union[l] = r;
+      }
+    } else if (it->second == r) {
+      expected_intersection[l] = r;
+    } else {
+      changed.emplace_back(l, it->second, r);
+    }
+  }
+  std::vector<std::pair<int, int>> removed;
+  for (auto [l, r] : a_pairs) {
+    auto it = b_pairs.find(l);
+    if (it == b_pairs.end() || it->second != r) {
+      expected_difference[l] = r;
+    }
+    if (it == b_pairs.end()) {
+      removed.emplace_back(l, r);
+    }
+  }
+
+  auto matches = [](bimap<int, int> const& c, std::map<int, int> const& m) {
+    if (c.size() != m.size()) {
+      return false;
+    }
+    auto it = c.begin_left();
+    for (auto [l, r] : m) {
+      if (*it != l || *it.flip() != r || c.at_right(r) != l) {
+        return false;
+      }
+      ++it;
+    }
+    return true;
+  };
+  for (size_t threads : {1, 4}) {
+    EXPECT_TRUE(matches(set_union(a, b, threads), expected_union));
+    EXPECT_TRUE(
+        matches(set_intersection(a, b, threads), expected_intersection));
+    EXPECT_TRUE(matches(set_difference(a, b, threads), expected_difference));
+    auto changes = diff(a, b, threads);
+    EXPECT_EQ(changes.added_, added);
+    EXPECT_EQ(changes.removed_, removed);
+    EXPECT_EQ(changes.changed_, changed);
+  }
+  EXPECT_TRUE(set_union(a, a) == a);
+  EXPECT_TRUE(set_intersection(a, a) == a);
+  EXPECT_TRUE(set_difference(a, a).empty());
+  EXPECT_TRUE(set_union(bimap<int, int>(), b) == b);
+  EXPECT_TRUE(diff(a, a).changed_.empty());
+}
+
+TEST(bimap, set_operations_instrumented) {
+  // counted lookups may run on several threads at once
+  using counting_int_bimap =
+      bimap<int, int, std::less<int>, std::less<int>,
+            std::allocator<std::pair<int, int>>,
+            bimap_instrumentation::counting>;
+  counting_int_bimap a;
+  counting_int_bimap b;
+  for (int i = 0; i < 30000; i++) {
+    a.insert(2 * i, i);
+    b.insert(2 * i, i % 3 == 0 ? i : -i);
+  }
+  size_t lookups = a.stats().left_.lookups_;
+  counting_int_bimap one = set_intersection(a, b, 1);
+  counting_int_bimap many = set_intersection(a, b, 4);
+  EXPECT_TRUE(one == many);
+  EXPECT_EQ(one.size(), 10000);
+  EXPECT_GT(a.stats().left_.lookups_, lookups);
+}
+
+TEST(bimap, set_operations_stateful_comparators) {
+  using ordered_bimap = bimap<int, int, int_order, int_order>;
+  ordered_bimap a(int_order(true), int_order(true));
+  ordered_bimap b(int_order(true), int_order(true));
+  for (int i = 0; i < 100; i++) {
+    a.insert(2 * i, i);
+    b.insert(2 * i, i % 3 == 0 ? i : -i);
+  }
+  // equal descending orders: the join walks both from the greatest key
+  ordered_bimap both = set_intersection(a, b, 1);
+  ASSERT_EQ(both.size(), 34);
+  EXPECT_EQ(*both.begin_left(), 198);
+  EXPECT_EQ(both.at_left(6), 3);
+  ordered_bimap only_a = set_difference(a, b, 1);
+  EXPECT_EQ(only_a.size(), 66);
+  EXPECT_EQ(*only_a.begin_left(), 196);
+  EXPECT_EQ(only_a.find_left(6), only_a.end_left());
+  EXPECT_EQ(only_a.at_left(2), 1);
+
+  // b sorted the other way breaks the precondition
+  ordered_bimap ascending(int_order(false), int_order(false));
+  ascending.insert(1, 1);
+  ascending.insert(2, 2);
+  EXPECT_DEBUG_DEATH(set_intersection(a, ascending, 1), "");
+}
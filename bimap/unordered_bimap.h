@@ -0,0 +1,731 @@
+#pragma once
+
+#include "bimap_nodes.h"
+#include "bimap_pool.h"
+#include "bimap_tree.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace bimap_hash {
+
+// All pairs of an unordered_bimap are kept in one circular list in insertion
+// order. Both sides iterate over it, so flip() never moves an iterator.
+struct list_node {
+  list_node() = default;
+  list_node(list_node const&) = delete;
+  list_node& operator=(list_node const&) = delete;
+
+  void link_before(list_node* pos) {
+    prev_ = pos->prev_;
+    next_ = pos;
+    prev_->next_ = this;
+    pos->prev_ = this;
+  }
+
+  void unlink() {
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    prev_ = next_ = this;
+  }
+
+  // this must be an empty fake node, other becomes one
+  void take_over(list_node& other) {
+    if (other.next_ == &other) {
+      return;
+    }
+    prev_ = other.prev_;
+    next_ = other.next_;
+    prev_->next_ = next_->prev_ = this;
+    other.prev_ = other.next_ = &other;
+  }
+
+  list_node* prev_{this};
+  list_node* next_{this};
+};
+
+template <typename L, typename R>
+struct node : list_node {
+  template <typename A, typename B>
+  node(A&& left, B&& right)
+      : l_element(std::forward<A>(left)), r_element(std::forward<B>(right)) {}
+
+  node* next_left_{nullptr};
+  node* next_right_{nullptr};
+  size_t left_hash_{0};
+  size_t right_hash_{0};
+  L l_element;
+  R r_element;
+};
+
+template <typename Tag, typename Node>
+auto& element(Node* ptr) {
+  if constexpr (nodes::is_left<Tag>) {
+    return ptr->l_element;
+  } else {
+    return ptr->r_element;
+  }
+}
+
+template <typename Tag, typename Node>
+Node*& chain_next(Node* ptr) {
+  if constexpr (nodes::is_left<Tag>) {
+    return ptr->next_left_;
+  } else {
+    return ptr->next_right_;
+  }
+}
+
+template <typename Tag, typename Node>
+size_t& cached_hash(Node* ptr) {
+  if constexpr (nodes::is_left<Tag>) {
+    return ptr->left_hash_;
+  } else {
+    return ptr->right_hash_;
+  }
+}
+
+// Hash index over one side: a power of two number of buckets, each a chain
+// through the nodes' next_left_ or next_right_.
+template <typename Node, typename Tag, typename Hash, typename Equal,
+          typename Allocator>
+struct index {
+private:
+  using bucket_allocator =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<Node*>;
+
+public:
+  index(Hash hash, Equal equal, Allocator const& alloc)
+      : buckets_(bucket_allocator(alloc)), hash_(std::move(hash)),
+        equal_(std::move(equal)) {}
+
+  // the std::hash of integers is the identity, so the bits are mixed before
+  // a bucket is chosen by the highest ones
+  template <typename K>
+  size_t hash(K const& key) const {
+    return static_cast<size_t>(hash_(key)) * 0x9E3779B97F4A7C15ull;
+  }
+
+  template <typename K>
+  Node* find(K const& key, size_t hash) const {
+    if (buckets_.empty()) {
+      return nullptr;
+    }
+    for (Node* cur = buckets_[bucket(hash)]; cur != nullptr;
+         cur = chain_next<Tag>(cur)) {
+      if (cached_hash<Tag>(cur) == hash && equal_(element<Tag>(cur), key)) {
+        return cur;
+      }
+    }
+    return nullptr;
+  }
+
+  // the node's hash must already be cached
+  void link(Node* ptr) {
+    Node*& head = buckets_[bucket(cached_hash<Tag>(ptr))];
+    chain_next<Tag>(ptr) = head;
+    head = ptr;
+  }
+
+  void unlink(Node* ptr) {
+    Node** cur = &buckets_[bucket(cached_hash<Tag>(ptr))];
+    while (*cur != ptr) {
+      cur = &chain_next<Tag>(*cur);
+    }
+    *cur = chain_next<Tag>(ptr);
+    chain_next<Tag>(ptr) = nullptr;
+  }
+
+  // relinks all nodes of the list into count buckets, count is a power of 2
+  void rehash(size_t count, list_node* fake) {
+    buckets_.assign(count, nullptr);
+    shift_ = 64 - std::countr_zero(count);
+    for (list_node* cur = fake->next_; cur != fake; cur = cur->next_) {
+      link(static_cast<Node*>(cur));
+    }
+  }
+
+  void clear() {
+    std::fill(buckets_.begin(), buckets_.end(), nullptr);
+  }
+
+  size_t bucket_count() const {
+    return buckets_.size();
+  }
+
+  Hash const& hash_function() const {
+    return hash_;
+  }
+
+  Equal const& key_eq() const {
+    return equal_;
+  }
+
+  template <typename A, typename B>
+  bool equal(A const& a, B const& b) const {
+    return equal_(a, b);
+  }
+
+  void swap(index& other) {
+    using std::swap;
+    buckets_.swap(other.buckets_);
+    swap(shift_, other.shift_);
+    swap(hash_, other.hash_);
+    swap(equal_, other.equal_);
+  }
+
+private:
+  size_t bucket(size_t hash) const {
+    return shift_ == 64 ? 0 : hash >> shift_;
+  }
+
+  std::vector<Node*, bucket_allocator> buckets_;
+  int shift_{64};
+  [[no_unique_address]] Hash hash_;
+  [[no_unique_address]] Equal equal_;
+};
+
+template <typename Hash, typename Equal>
+concept transparent =
+    bimap_tree::transparent<Hash> && bimap_tree::transparent<Equal>;
+} // namespace bimap_hash
+
+// bimap, в котором обе стороны индексируются хеш-таблицами: поиск, вставка
+// и удаление работают за O(1) в среднем. Итераторы обеих сторон обходят пары
+// в порядке вставки.
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>,
+          typename EqualLeft = std::equal_to<Left>,
+          typename EqualRight = std::equal_to<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+struct unordered_bimap {
+private:
+  using left_t = Left;
+  using right_t = Right;
+
+  using alloc_traits = std::allocator_traits<Allocator>;
+
+  using list_node_t = bimap_hash::list_node;
+  using node_t = bimap_hash::node<left_t, right_t>;
+
+  using left_index_t = bimap_hash::index<node_t, nodes::left_tag, HashLeft,
+                                         EqualLeft, Allocator>;
+  using right_index_t = bimap_hash::index<node_t, nodes::right_tag, HashRight,
+                                          EqualRight, Allocator>;
+
+  static constexpr size_t min_bucket_count = 16;
+
+  template <typename Tag>
+  struct iterator {
+    using value_type = std::conditional_t<nodes::is_left<Tag>, left_t, right_t>;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using difference_type = ptrdiff_t;
+
+  private:
+    using other_tag = std::conditional_t<nodes::is_left<Tag>, nodes::right_tag,
+                                         nodes::left_tag>;
+    explicit iterator(list_node_t* node) : node_(node) {}
+
+  public:
+    iterator() = default;
+
+    value_type const& operator*() const {
+      return bimap_hash::element<Tag>(static_cast<node_t*>(node_));
+    }
+    value_type const* operator->() const {
+      return &operator*();
+    }
+
+    iterator& operator++() {
+      node_ = node_->next_;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator res = *this;
+      operator++();
+      return res;
+    }
+
+    iterator& operator--() {
+      node_ = node_->prev_;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator res = *this;
+      operator--();
+      return res;
+    }
+
+    iterator<other_tag> flip() const {
+      return iterator<other_tag>(node_);
+    }
+
+    friend bool operator==(iterator const& a, iterator const& b) {
+      return a.node_ == b.node_;
+    }
+
+    friend bool operator!=(iterator const& a, iterator const& b) {
+      return a.node_ != b.node_;
+    }
+
+    friend struct unordered_bimap;
+
+  private:
+    list_node_t* node_{nullptr};
+  };
+
+public:
+  using left_iterator = iterator<nodes::left_tag>;
+  using right_iterator = iterator<nodes::right_tag>;
+  using allocator_type = Allocator;
+
+  // Создает unordered_bimap не содержащий ни одной пары. Пустой
+  // unordered_bimap не делает динамических аллокаций.
+  explicit unordered_bimap(HashLeft hash_left = HashLeft(),
+                           HashRight hash_right = HashRight(),
+                           EqualLeft equal_left = EqualLeft(),
+                           EqualRight equal_right = EqualRight(),
+                           Allocator const& alloc = Allocator())
+      : left_index_(std::move(hash_left), std::move(equal_left), alloc),
+        right_index_(std::move(hash_right), std::move(equal_right), alloc),
+        pool_(alloc) {}
+
+  explicit unordered_bimap(Allocator const& alloc)
+      : unordered_bimap(HashLeft(), HashRight(), EqualLeft(), EqualRight(),
+                        alloc) {}
+
+  unordered_bimap(unordered_bimap const& other)
+      : unordered_bimap(
+            other, alloc_traits::select_on_container_copy_construction(
+                       other.get_allocator())) {}
+
+  // хеши пар не пересчитываются, ключи не сравниваются
+  unordered_bimap(unordered_bimap const& other, Allocator const& alloc)
+      : unordered_bimap(other.left_index_.hash_function(),
+                        other.right_index_.hash_function(),
+                        other.left_index_.key_eq(), other.right_index_.key_eq(),
+                        alloc) {
+    if (other.empty()) {
+      return;
+    }
+    rehash_to(other.left_index_.bucket_count());
+    for (left_iterator it = other.begin_left(); it != other.end_left(); it++) {
+      node_t* from = node_of(it);
+      node_t* node = create_node(from->l_element, from->r_element);
+      node->left_hash_ = from->left_hash_;
+      node->right_hash_ = from->right_hash_;
+      link_node(node);
+    }
+  }
+
+  unordered_bimap(unordered_bimap&& other) noexcept
+      : left_index_(std::move(other.left_index_)),
+        right_index_(std::move(other.right_index_)),
+        size_(std::exchange(other.size_, 0)),
+        pool_(std::move(other.pool_)) {
+    fake_.take_over(other.fake_);
+  }
+
+  unordered_bimap& operator=(unordered_bimap const& other) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (alloc_traits::propagate_on_container_copy_assignment::value) {
+      unordered_bimap(other, other.get_allocator()).swap_contents(*this);
+    } else {
+      unordered_bimap(other, get_allocator()).swap_contents(*this);
+    }
+    return *this;
+  }
+  unordered_bimap& operator=(unordered_bimap&& other) noexcept(
+      alloc_traits::propagate_on_container_move_assignment::value ||
+      alloc_traits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    if constexpr (alloc_traits::propagate_on_container_move_assignment::value ||
+                  alloc_traits::is_always_equal::value) {
+      swap_contents(other);
+    } else if (get_allocator() == other.get_allocator()) {
+      swap_contents(other);
+    } else {
+      unordered_bimap tmp(get_allocator());
+      tmp.rehash_to(other.left_index_.bucket_count());
+      for (left_iterator it = other.begin_left(); it != other.end_left();
+           it++) {
+        node_t* from = node_of(it);
+        node_t* node = tmp.create_node(std::move(from->l_element),
+                                       std::move(from->r_element));
+        node->left_hash_ = from->left_hash_;
+        node->right_hash_ = from->right_hash_;
+        tmp.link_node(node);
+      }
+      other.clear();
+      tmp.swap_contents(*this);
+    }
+    return *this;
+  }
+
+  void swap(unordered_bimap& other) {
+    assert(alloc_traits::propagate_on_container_swap::value ||
+           get_allocator() == other.get_allocator());
+    swap_contents(other);
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(pool_.get_allocator());
+  }
+
+  ~unordered_bimap() {
+    clear();
+  }
+
+  // Вставка пары (left, right), возвращает итератор на left.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится и возвращается end_left().
+  left_iterator insert(left_t const& left, right_t const& right) {
+    return insert_impl(left, right);
+  }
+  left_iterator insert(left_t const& left, right_t&& right) {
+    return insert_impl(left, std::move(right));
+  }
+  left_iterator insert(left_t&& left, right_t const& right) {
+    return insert_impl(std::move(left), right);
+  }
+  left_iterator insert(left_t&& left, right_t&& right) {
+    return insert_impl(std::move(left), std::move(right));
+  }
+
+  // Удаляет пару, на элемент которой указывает it, возвращает итератор на
+  // следующий элемент.
+  left_iterator erase_left(left_iterator it) {
+    left_iterator res = std::next(it);
+    erase_node(node_of(it));
+    return res;
+  }
+  right_iterator erase_right(right_iterator it) {
+    right_iterator res = std::next(it);
+    erase_node(node_of(it));
+    return res;
+  }
+
+  // Удаляет пару по ключу, возвращает была ли пара удалена. При прозрачных
+  // хеше и равенстве ключ может быть любого сравнимого типа, как и в
+  // остальных поисках по ключу.
+  bool erase_left(left_t const& left) {
+    return erase_key_impl<nodes::left_tag>(left);
+  }
+  template <typename K>
+    requires(bimap_hash::transparent<HashLeft, EqualLeft> &&
+             !std::is_convertible_v<K const&, left_iterator>)
+  bool erase_left(K const& left) {
+    return erase_key_impl<nodes::left_tag>(left);
+  }
+  bool erase_right(right_t const& right) {
+    return erase_key_impl<nodes::right_tag>(right);
+  }
+  template <typename K>
+    requires(bimap_hash::transparent<HashRight, EqualRight> &&
+             !std::is_convertible_v<K const&, right_iterator>)
+  bool erase_right(K const& right) {
+    return erase_key_impl<nodes::right_tag>(right);
+  }
+
+  // Удаляет [first, last) в порядке обхода
+  left_iterator erase_left(left_iterator first, left_iterator last) {
+    while (first != last) {
+      first = erase_left(first);
+    }
+    return first;
+  }
+  right_iterator erase_right(right_iterator first, right_iterator last) {
+    while (first != last) {
+      first = erase_right(first);
+    }
+    return first;
+  }
+
+  void clear() {
+    for (list_node_t* cur = fake_.next_; cur != &fake_;) {
+      node_t* node = static_cast<node_t*>(cur);
+      cur = cur->next_;
+      destroy_node(node);
+    }
+    fake_.prev_ = fake_.next_ = &fake_;
+    left_index_.clear();
+    right_index_.clear();
+    size_ = 0;
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(left_t const& left) const {
+    return find_impl<nodes::left_tag>(left);
+  }
+  template <typename K>
+    requires bimap_hash::transparent<HashLeft, EqualLeft>
+  left_iterator find_left(K const& left) const {
+    return find_impl<nodes::left_tag>(left);
+  }
+  right_iterator find_right(right_t const& right) const {
+    return find_impl<nodes::right_tag>(right);
+  }
+  template <typename K>
+    requires bimap_hash::transparent<HashRight, EqualRight>
+  right_iterator find_right(K const& right) const {
+    return find_impl<nodes::right_tag>(right);
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const& at_left(left_t const& key) const {
+    return at_impl<nodes::left_tag>(key);
+  }
+  template <typename K>
+    requires bimap_hash::transparent<HashLeft, EqualLeft>
+  right_t const& at_left(K const& key) const {
+    return at_impl<nodes::left_tag>(key);
+  }
+  left_t const& at_right(right_t const& key) const {
+    return at_impl<nodes::right_tag>(key);
+  }
+  template <typename K>
+    requires bimap_hash::transparent<HashRight, EqualRight>
+  left_t const& at_right(K const& key) const {
+    return at_impl<nodes::right_tag>(key);
+  }
+
+  // Как у bimap: если ключа нет, вставляет пару с дефолтным элементом на
+  // противоположной стороне; если дефолтный элемент уже занят, его пара
+  // получает запрашиваемый ключ.
+  template <typename R = right_t,
+            typename std::enable_if_t<std::is_default_constructible_v<R>,
+                                      bool> = true>
+  right_t const& at_left_or_default(left_t const& key) {
+    left_iterator it_l = find_left(key);
+    if (it_l != end_left()) {
+      return *(it_l.flip());
+    }
+    right_t tmp = right_t();
+    right_iterator it_r = find_right(tmp);
+    if (it_r == end_right()) {
+      return *(insert(key, std::move(tmp)).flip());
+    }
+    rekey<nodes::left_tag>(node_of(it_r), key);
+    return *it_r;
+  }
+
+  template <typename L = left_t,
+            typename std::enable_if_t<std::is_default_constructible_v<L>,
+                                      bool> = true>
+  left_t const& at_right_or_default(right_t const& key) {
+    right_iterator it_r = find_right(key);
+    if (it_r != end_right()) {
+      return *(it_r.flip());
+    }
+    left_t tmp = left_t();
+    left_iterator it_l = find_left(tmp);
+    if (it_l == end_left()) {
+      return *insert(std::move(tmp), key);
+    }
+    rekey<nodes::right_tag>(node_of(it_l), key);
+    return *it_l;
+  }
+
+  // Готовит таблицы к count парам без перехеширования
+  void reserve(size_t count) {
+    if (count > left_index_.bucket_count()) {
+      rehash_to(std::bit_ceil(std::max(count, min_bucket_count)));
+    }
+  }
+
+  left_iterator begin_left() const {
+    return left_iterator(fake_.next_);
+  }
+  left_iterator end_left() const {
+    return left_iterator(fake());
+  }
+  right_iterator begin_right() const {
+    return right_iterator(fake_.next_);
+  }
+  right_iterator end_right() const {
+    return right_iterator(fake());
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+  // равны, если состоят из одних и тех же пар
+  friend bool operator==(unordered_bimap const& a, unordered_bimap const& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (left_iterator it = a.begin_left(); it != a.end_left(); it++) {
+      left_iterator other = b.find_left(*it);
+      if (other == b.end_left() ||
+          !a.right_index_.equal(*it.flip(), *other.flip())) {
+        return false;
+      }
+    }
+    return true;
+  }
+  friend bool operator!=(unordered_bimap const& a, unordered_bimap const& b) {
+    return !(a == b);
+  }
+
+private:
+  list_node_t* fake() const {
+    return const_cast<list_node_t*>(&fake_);
+  }
+
+  template <typename Tag>
+  static node_t* node_of(iterator<Tag> it) {
+    return static_cast<node_t*>(it.node_);
+  }
+
+  template <typename Tag>
+  auto const& index_of() const {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_index_;
+    } else {
+      return right_index_;
+    }
+  }
+
+  template <typename Tag>
+  auto& index_of() {
+    if constexpr (nodes::is_left<Tag>) {
+      return left_index_;
+    } else {
+      return right_index_;
+    }
+  }
+
+  template <typename Tag, typename K>
+  iterator<Tag> find_impl(K const& key) const {
+    auto const& index = index_of<Tag>();
+    node_t* node = index.find(key, index.hash(key));
+    if (node == nullptr) {
+      return iterator<Tag>(fake());
+    }
+    return iterator<Tag>(node);
+  }
+
+  template <typename Tag, typename K>
+  auto const& at_impl(K const& key) const {
+    iterator<Tag> it = find_impl<Tag>(key);
+    if (it.node_ == &fake_) {
+      throw std::out_of_range("No such key");
+    }
+    return *(it.flip());
+  }
+
+  template <typename Tag, typename K>
+  bool erase_key_impl(K const& key) {
+    iterator<Tag> it = find_impl<Tag>(key);
+    if (it.node_ == &fake_) {
+      return false;
+    }
+    erase_node(node_of(it));
+    return true;
+  }
+
+  template <typename A, typename B>
+  left_iterator insert_impl(A&& left, B&& right) {
+    size_t left_hash = left_index_.hash(left);
+    if (left_index_.find(left, left_hash) != nullptr) {
+      return end_left();
+    }
+    size_t right_hash = right_index_.hash(right);
+    if (right_index_.find(right, right_hash) != nullptr) {
+      return end_left();
+    }
+    if (size_ + 1 > left_index_.bucket_count()) {
+      rehash_to(std::max(2 * left_index_.bucket_count(), min_bucket_count));
+    }
+    node_t* node = create_node(std::forward<A>(left), std::forward<B>(right));
+    node->left_hash_ = left_hash;
+    node->right_hash_ = right_hash;
+    link_node(node);
+    return left_iterator(node);
+  }
+
+  // Gives the pair of ptr a new key on the Tag side
+  template <typename Tag, typename K>
+  void rekey(node_t* ptr, K const& key) {
+    auto& index = index_of<Tag>();
+    size_t hash = index.hash(key);
+    bimap_hash::element<Tag>(ptr) = key;
+    // unlink() finds the bucket by the old cached hash
+    index.unlink(ptr);
+    bimap_hash::cached_hash<Tag>(ptr) = hash;
+    index.link(ptr);
+  }
+
+  // there must be enough buckets
+  void link_node(node_t* node) {
+    left_index_.link(node);
+    right_index_.link(node);
+    node->link_before(&fake_);
+    size_++;
+  }
+
+  void erase_node(node_t* node) {
+    left_index_.unlink(node);
+    right_index_.unlink(node);
+    node->unlink();
+    destroy_node(node);
+    size_--;
+  }
+
+  void rehash_to(size_t count) {
+    left_index_.rehash(count, &fake_);
+    right_index_.rehash(count, &fake_);
+  }
+
+  template <typename A, typename B>
+  node_t* create_node(A&& left, B&& right) {
+    void* place = pool_.allocate();
+    try {
+      return new (place) node_t(std::forward<A>(left), std::forward<B>(right));
+    } catch (...) {
+      pool_.deallocate(place);
+      throw;
+    }
+  }
+  void destroy_node(node_t* node) {
+    node->~node_t();
+    pool_.deallocate(node);
+  }
+
+  void swap_contents(unordered_bimap& other) {
+    left_index_.swap(other.left_index_);
+    right_index_.swap(other.right_index_);
+    list_node_t tmp;
+    tmp.take_over(fake_);
+    fake_.take_over(other.fake_);
+    other.fake_.take_over(tmp);
+    std::swap(size_, other.size_);
+    pool_.swap(other.pool_);
+  }
+
+  left_index_t left_index_;
+  right_index_t right_index_;
+  list_node_t fake_;
+  size_t size_{0};
+  bimap_pool::pool<node_t, Allocator> pool_;
+};